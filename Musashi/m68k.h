@@ -54,6 +54,13 @@ extern "C" {
 #include "m68kconf.h"
 #endif
 
+/* Storage class for the CPU state, see M68K_THREAD_LOCAL in m68kconf.h */
+#if M68K_THREAD_LOCAL
+#define M68K_TLS __thread
+#else
+#define M68K_TLS
+#endif
+
 /* ======================================================================== */
 /* ============================ GENERAL DEFINES =========================== */
 
@@ -302,6 +309,7 @@ void m68k_set_instr_hook_callback(void  (*callback)(unsigned int pc));
 /* Use this function to set the CPU type you want to emulate.
  * Currently supported types are: M68K_CPU_TYPE_68000, M68K_CPU_TYPE_68010,
  * M68K_CPU_TYPE_EC020, and M68K_CPU_TYPE_68020.
+ * With M68K_68000_ONLY, other types are ignored.
  */
 void m68k_set_cpu_type(unsigned int cpu_type);
 
@@ -318,7 +326,9 @@ void m68k_init(void);
  */
 void m68k_pulse_reset(void);
 
-/* execute num_cycles worth of instructions.  returns number of cycles used */
+/* execute num_cycles worth of instructions.  returns number of cycles used
+ * (with M68K_INSTRUCTION_BUDGET, cycles are instructions)
+ */
 int m68k_execute(int num_cycles);
 
 /* These functions let you read/write/modify the number of cycles left to run
@@ -348,12 +358,50 @@ unsigned int m68k_get_virq(unsigned int level);
 void m68k_pulse_halt(void);
 
 
-/* Trigger a bus error exception */
+/* Trigger a bus error exception, only with M68K_EMULATE_BUS_ERROR */
 void m68k_pulse_bus_error(void);
 
 
+/* Only available with M68K_DIRECT_RAM.  Addresses from 0 up to size are read
+ * and written directly on base (big-endian) instead of through the
+ * m68k_read_memory_xx() and m68k_write_memory_xx() callbacks.  This belongs to
+ * the current CPU context, and a size of 0 turns it off.  Set it after
+ * m68k_init().
+ */
+void m68k_set_direct_ram(unsigned char *base, unsigned int size);
+
+/* Only does something with M68K_DECODE_CACHE.  Call this after the host has
+ * written code into the direct RAM while the CPU was running, the CPU's own
+ * writes and writes made from the illegal instruction callback are handled
+ * automatically.
+ */
+void m68k_invalidate_decode_cache(void);
+
+/* Only available with M68K_JIT.  Turns the block cache of the current CPU
+ * context on (M68K_JIT_ON) or off (M68K_JIT_OFF).  M68K_JIT_VERIFY runs every
+ * compiled block a second time with the interpreter and aborts if the
+ * registers, cycles or memory writes differ, which assumes that the memory
+ * outside the direct RAM has no side effects.  Set it after
+ * m68k_set_direct_ram(), returns 0 if the block cache is not available.
+ */
+enum
+{
+	M68K_JIT_OFF,
+	M68K_JIT_ON,
+	M68K_JIT_VERIFY
+};
+
+int m68k_set_jit(int mode);
+
+
 /* Context switching to allow multiple CPUs */
 
+/* Make ctx the current CPU, execute num_cycles worth of instructions, and
+ * save the CPU back into ctx.  ctx is a buffer of m68k_context_size() bytes
+ * that was filled in by m68k_get_context().  returns number of cycles used
+ */
+int m68k_execute_ctx(void* ctx, int num_cycles);
+
 /* Get the size of the cpu context in bytes */
 unsigned int m68k_context_size(void);
 
@@ -363,6 +411,21 @@ unsigned int m68k_get_context(void* dst);
 /* set the current cpu context */
 void m68k_set_context(void* dst);
 
+/* Free what m68k_init() and m68k_set_jit() allocated for the CPU saved in
+ * ctx, without touching the current CPU.  A context filled in by
+ * m68k_get_context() owns these, and m68k_init() leaves them alone once
+ * the CPU has been saved, so every context has to be freed this way when
+ * it is no longer needed.
+ */
+void m68k_free_context(void* ctx);
+
+/* A pointer of the host that is kept in the current CPU context, and is
+ * switched with it, so that the callbacks can tell which of several CPUs
+ * they are called for.  m68k_init() does not change it.
+ */
+void m68k_set_user_data(void* data);
+void* m68k_get_user_data(void);
+
 /* Register the CPU state information */
 void m68k_state_register(const char *type, int index);
 
@@ -70,6 +70,15 @@
 #define M68K_EMULATE_030            OPT_OFF
 #define M68K_EMULATE_040            OPT_OFF
 
+/* If ON, only the 68000 is built: m68kmake leaves out the opcode handlers
+ * and cycle tables of the later CPUs, and the FPU and PMMU code is not
+ * compiled, so softfloat is not needed either.  m68k_set_cpu_type() only
+ * accepts M68K_CPU_TYPE_68000.  Needs all of the variants above OFF.
+ */
+#ifndef M68K_68000_ONLY
+#define M68K_68000_ONLY             OPT_OFF
+#endif
+
 
 /* If ON, the CPU will call m68k_read_immediate_xx() for immediate addressing
  * and m68k_read_pcrelative_xx() for PC-relative addressing.
@@ -138,7 +147,7 @@
  * You should put OPT_SPECIFY_HANDLER here if you cant to use it, otherwise it will
  * use a dummy default handler and you'll have to call m68k_set_illg_instr_callback explicitely
  */
-#define M68K_ILLG_HAS_CALLBACK	    OPT_OFF
+#define M68K_ILLG_HAS_CALLBACK	    OPT_ON
 #define M68K_ILLG_CALLBACK(opcode)  op_illg(opcode)
 
 /* If ON, CPU will call the set fc callback on every memory access to
@@ -160,8 +169,12 @@
 
 /* If ON, CPU will call the instruction hook callback before every
  * instruction.
+ * The narrator and translator hosts only use it to trace every instruction,
+ * build with -DM68K_INSTRUCTION_HOOK=OPT_ON to enable it.
  */
-#define M68K_INSTRUCTION_HOOK       OPT_ON
+#ifndef M68K_INSTRUCTION_HOOK
+#define M68K_INSTRUCTION_HOOK       OPT_OFF
+#endif
 #define M68K_INSTRUCTION_CALLBACK(pc) your_instruction_hook_function(pc)
 
 
@@ -176,6 +189,16 @@
 #define M68K_EMULATE_ADDRESS_ERROR  OPT_OFF
 
 
+/* If ON, m68k_pulse_bus_error() can be called from a memory callback to raise
+ * a bus error exception.  This makes m68k_execute() save the data and address
+ * registers before every instruction and set up a setjmp() return point.  If
+ * OFF, m68k_pulse_bus_error() does nothing.
+ */
+#ifndef M68K_EMULATE_BUS_ERROR
+#define M68K_EMULATE_BUS_ERROR      OPT_OFF
+#endif
+
+
 /* Turn ON to enable logging of illegal instruction calls.
  * M68K_LOG_FILEHANDLE must be #defined to a stdio file stream.
  * Turn on M68K_LOG_1010_1111 to log all 1010 and 1111 calls.
@@ -184,6 +207,62 @@
 #define M68K_LOG_1010_1111          OPT_OFF
 #define M68K_LOG_FILEHANDLE         some_file_handle
 
+/* If ON, the CPU state is kept in thread-local storage, so every thread runs
+ * its own independent CPU.  m68k_init() must be called in every thread that
+ * uses the CPU, and m68k_execute_ctx() can be used to run several CPUs from
+ * one thread.
+ */
+#ifndef M68K_THREAD_LOCAL
+#define M68K_THREAD_LOCAL           OPT_ON
+#endif
+
+/* If ON, the host can give Musashi a block of RAM with m68k_set_direct_ram().
+ * Accesses inside it are made directly on the host memory, and only the
+ * accesses outside of it call m68k_read_memory_xx() and m68k_write_memory_xx().
+ * Opcode fetches and operands then become inlined loads instead of calls.
+ */
+#ifndef M68K_DIRECT_RAM
+#define M68K_DIRECT_RAM             OPT_ON
+#endif
+
+/* If ON, m68k_execute() keeps a cache of decoded opcodes (handler and cycles)
+ * by address, so that an instruction that is executed again is not fetched
+ * and looked up in the jump table again.  Only opcodes in the direct RAM are
+ * cached, writes by the CPU invalidate the entries they overlap, and the
+ * whole cache is invalidated after the illegal instruction callback or by
+ * m68k_invalidate_decode_cache() when the host writes code itself.
+ * Needs M68K_DIRECT_RAM, and cannot be used with M68K_EMULATE_PREFETCH or
+ * M68K_INSTRUCTION_HOOK.
+ */
+#ifndef M68K_DECODE_CACHE
+#define M68K_DECODE_CACHE           OPT_OFF
+#endif
+
+/* If ON, m68k_execute() and the functions that deal with cycles count
+ * instructions instead: every instruction uses 1 of the budget, and the
+ * timing of instructions and exceptions is not computed at all.  For hosts
+ * that only use the cycles to leave m68k_execute() now and then.
+ */
+#ifndef M68K_INSTRUCTION_BUDGET
+#define M68K_INSTRUCTION_BUDGET     OPT_OFF
+#endif
+
+/* If ON, m68k_set_jit() can turn on a call-threaded block cache for x86-64
+ * hosts.  This is not a recompiler: blocks of opcodes that are executed often
+ * are turned into host code that only calls the opcode handlers one after
+ * the other, without fetching and decoding the opcodes again, and the
+ * handlers compute the flags as usual.  Blocks are rebuilt when the CPU
+ * writes over their code or after the illegal instruction callback.  The
+ * code buffer is never writable and executable at once, m68k_set_jit() fails
+ * if the system does not allow memory to be made executable.  Needs M68K_DIRECT_RAM, cannot
+ * be used with M68K_EMULATE_PREFETCH, M68K_INSTRUCTION_HOOK,
+ * M68K_EMULATE_TRACE or M68K_EMULATE_BUS_ERROR.  On other hosts
+ * m68k_set_jit() always fails.
+ */
+#ifndef M68K_JIT
+#define M68K_JIT                    OPT_OFF
+#endif
+
 /* Emulate PMMU : if you enable this, there will be a test to see if the current chip has some enabled pmmu added to every memory access,
  * so enable this only if it's useful */
 #define M68K_EMULATE_PMMU   OPT_OFF
@@ -38,27 +38,35 @@
 /* ================================ INCLUDES ============================== */
 /* ======================================================================== */
 
+#if !M68K_68000_ONLY
 extern void m68040_fpu_op0(void);
 extern void m68040_fpu_op1(void);
 extern void m68881_mmu_ops(void);
-extern unsigned char m68ki_cycles[][0x10000];
-extern void (*m68ki_instruction_jump_table[0x10000])(void); /* opcode handler jump table */
-extern void m68ki_build_opcode_table(void);
+#endif
+extern const unsigned char m68ki_cycles[][0x10000];
+extern void (*const m68ki_instruction_handler_table[])(void); /* opcode handlers by index */
+extern const unsigned short m68ki_instruction_jump_table[0x10000]; /* opcode handler jump table */
 
 #include "m68kops.h"
 #include "m68kcpu.h"
 
+#if M68K_DECODE_CACHE
+#include <stdlib.h>
+#endif
+
+#if !M68K_68000_ONLY
 #include "m68kfpu.c"
 #include "m68kmmu.h" // uses some functions from m68kfpu.c which are static !
+#endif
 
 /* ======================================================================== */
 /* ================================= DATA ================================= */
 /* ======================================================================== */
 
-int  m68ki_initial_cycles;
-int  m68ki_remaining_cycles = 0;                     /* Number of clocks remaining */
-uint m68ki_tracing = 0;
-uint m68ki_address_space;
+M68K_TLS int  m68ki_initial_cycles;
+M68K_TLS int  m68ki_remaining_cycles = 0;                     /* Number of clocks remaining */
+M68K_TLS uint m68ki_tracing = 0;
+M68K_TLS uint m68ki_address_space;
 
 #ifdef M68K_LOG_ENABLE
 const char *const m68ki_cpu_names[] =
@@ -78,21 +86,23 @@ const char *const m68ki_cpu_names[] =
 #endif /* M68K_LOG_ENABLE */
 
 /* The CPU core */
-m68ki_cpu_core m68ki_cpu = {0};
+M68K_TLS m68ki_cpu_core m68ki_cpu = {0};
 
 #if M68K_EMULATE_ADDRESS_ERROR
 #ifdef _BSD_SETJMP_H
-sigjmp_buf m68ki_aerr_trap;
+M68K_TLS sigjmp_buf m68ki_aerr_trap;
 #else
-jmp_buf m68ki_aerr_trap;
+M68K_TLS jmp_buf m68ki_aerr_trap;
 #endif
 #endif /* M68K_EMULATE_ADDRESS_ERROR */
 
-uint    m68ki_aerr_address;
-uint    m68ki_aerr_write_mode;
-uint    m68ki_aerr_fc;
+M68K_TLS uint    m68ki_aerr_address;
+M68K_TLS uint    m68ki_aerr_write_mode;
+M68K_TLS uint    m68ki_aerr_fc;
 
-jmp_buf m68ki_bus_error_jmp_buf;
+#if M68K_EMULATE_BUS_ERROR
+M68K_TLS jmp_buf m68ki_bus_error_jmp_buf;
+#endif
 
 /* Used by shift & rotate instructions */
 const uint8 m68ki_shift_8_table[65] =
@@ -779,6 +789,9 @@ void m68k_set_instr_hook_callback(void  (*callback)(unsigned int pc))
 /* Set the CPU type. */
 void m68k_set_cpu_type(unsigned int cpu_type)
 {
+	/* the cached cycle counts are for the old type */
+	m68k_invalidate_decode_cache();
+
 	switch(cpu_type)
 	{
 		case M68K_CPU_TYPE_68000:
@@ -798,6 +811,7 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			CYC_RESET        = 132;
 			HAS_PMMU	 = 0;
 			return;
+#if !M68K_68000_ONLY
 		case M68K_CPU_TYPE_SCC68070:
 			m68k_set_cpu_type(M68K_CPU_TYPE_68010);
 			CPU_ADDRESS_MASK = 0xffffffff;
@@ -938,11 +952,90 @@ void m68k_set_cpu_type(unsigned int cpu_type)
 			m68ki_cpu.cyc_reset        = 518;
 			HAS_PMMU	       = 1;
 			return;
+#endif /* !M68K_68000_ONLY */
 	}
 }
 
 /* Execute some instructions until we use up num_cycles clock cycles */
 /* ASG: removed per-instruction interrupt checks */
+#if M68K_DECODE_CACHE
+/* Fetch the opcode at REG_PC from the cache, or decode it into the cache.
+ * returns NULL if the opcode is outside the direct RAM and cannot be cached
+ */
+static inline m68ki_decode_entry* m68ki_decode(void)
+{
+	uint pc = ADDRESS_68K(REG_PC);
+	m68ki_decode_entry* entry = &m68ki_cpu.decode_cache[M68K_DECODE_CACHE_INDEX(pc)];
+
+	if(entry->pc == pc && entry->generation == m68ki_cpu.decode_generation)
+		return entry;
+	if(!M68KI_DIRECT_RAM_HAS(pc, 2))
+		return NULL;
+
+	entry->pc = pc;
+	entry->generation = m68ki_cpu.decode_generation;
+	entry->ir = m68ki_direct_read_16(m68ki_cpu.direct_ram + pc);
+	entry->handler = m68ki_instruction_handler(entry->ir);
+	entry->cycles = CYC_INSTRUCTION[entry->ir];
+	return entry;
+}
+#endif /* M68K_DECODE_CACHE */
+
+/* Execute the instruction at REG_PC with the interpreter */
+static inline void m68ki_execute_instruction(void)
+{
+	/* Set tracing accodring to T1. (T0 is done inside instruction) */
+	m68ki_trace_t1(); /* auto-disable (see m68kcpu.h) */
+
+	/* Set the address space for reads */
+	m68ki_use_data_space(); /* auto-disable (see m68kcpu.h) */
+
+	/* Call external hook to peek at CPU */
+	m68ki_instr_hook(REG_PC); /* auto-disable (see m68kcpu.h) */
+
+	/* Record previous program counter */
+	REG_PPC = REG_PC;
+
+#if M68K_EMULATE_BUS_ERROR
+	/* Record previous D/A register state (in case of bus error) */
+	{
+		int i;
+		for (i = 15; i >= 0; i--){
+			REG_DA_SAVE[i] = REG_DA[i];
+		}
+	}
+#endif
+
+	/* Read an instruction and call its handler */
+#if M68K_DECODE_CACHE
+	{
+		m68ki_decode_entry* entry = (m68ki_cpu.decode_cache) ? m68ki_decode() : NULL;
+		if(entry)
+		{
+			REG_IR = entry->ir;
+			REG_PC += 2;
+			entry->handler();
+			USE_INSTRUCTION_CYCLES(entry->cycles);
+		}
+		else
+		{
+			REG_IR = m68ki_read_imm_16();
+			m68ki_instruction_handler(REG_IR)();
+			USE_INSTRUCTION_CYCLES(CYC_INSTRUCTION[REG_IR]);
+		}
+	}
+#else
+	REG_IR = m68ki_read_imm_16();
+	m68ki_instruction_handler(REG_IR)();
+	USE_INSTRUCTION_CYCLES(CYC_INSTRUCTION[REG_IR]);
+#endif
+
+	/* Trace m68k_exception, if necessary */
+	m68ki_exception_if_trace(); /* auto-disable (see m68kcpu.h) */
+}
+
+#include "m68kjit.c"
+
 int m68k_execute(int num_cycles)
 {
 	/* eat up any reset cycles */
@@ -972,31 +1065,11 @@ int m68k_execute(int num_cycles)
 		/* Main loop.  Keep going until we run out of clock cycles */
 		do
 		{
-			int i;
-			/* Set tracing accodring to T1. (T0 is done inside instruction) */
-			m68ki_trace_t1(); /* auto-disable (see m68kcpu.h) */
-
-			/* Set the address space for reads */
-			m68ki_use_data_space(); /* auto-disable (see m68kcpu.h) */
-
-			/* Call external hook to peek at CPU */
-			m68ki_instr_hook(REG_PC); /* auto-disable (see m68kcpu.h) */
-
-			/* Record previous program counter */
-			REG_PPC = REG_PC;
-
-			/* Record previous D/A register state (in case of bus error) */
-			for (i = 15; i >= 0; i--){
-				REG_DA_SAVE[i] = REG_DA[i];
-			}
-
-			/* Read an instruction and call its handler */
-			REG_IR = m68ki_read_imm_16();
-			m68ki_instruction_jump_table[REG_IR]();
-			USE_CYCLES(CYC_INSTRUCTION[REG_IR]);
-
-			/* Trace m68k_exception, if necessary */
-			m68ki_exception_if_trace(); /* auto-disable (see m68kcpu.h) */
+#if M68K_JIT
+			if(m68ki_cpu.jit && m68ki_jit_execute())
+				continue;
+#endif
+			m68ki_execute_instruction();
 		} while(GET_CYCLES() > 0);
 
 		/* set previous PC to current PC for the next entry into the loop */
@@ -1074,15 +1147,7 @@ unsigned int m68k_get_virq(unsigned int level)
 
 void m68k_init(void)
 {
-	static uint emulation_initialized = 0;
-
-	/* The first call to this function initializes the opcode handler jump table */
-	if(!emulation_initialized)
-		{
-		m68ki_build_opcode_table();
-		emulation_initialized = 1;
-	}
-
+	/* the opcode handler jump table is generated by m68kmake */
 	m68k_set_int_ack_callback(NULL);
 	m68k_set_bkpt_ack_callback(NULL);
 	m68k_set_reset_instr_callback(NULL);
@@ -1093,12 +1158,57 @@ void m68k_init(void)
 	m68k_set_pc_changed_callback(NULL);
 	m68k_set_fc_callback(NULL);
 	m68k_set_instr_hook_callback(NULL);
+	m68k_set_direct_ram(NULL, 0);
+
+#if M68K_DECODE_CACHE
+	/* every CPU needs a cache of its own, even when it is a new context on
+	 * a thread that already ran another one, the cache of the CPU that was
+	 * here is freed unless a context has a copy, which then owns it (see
+	 * m68k_free_context()) */
+	if(!m68ki_cpu.saved)
+		free(m68ki_cpu.decode_cache);
+	m68ki_cpu.decode_cache = calloc(M68K_DECODE_CACHE_SIZE, sizeof(m68ki_decode_entry));
+	m68ki_cpu.decode_generation = 1;
+#endif
+#if M68K_JIT
+	/* same as the decode cache */
+	if(!m68ki_cpu.saved && m68ki_cpu.jit)
+		m68ki_jit_free(m68ki_cpu.jit);
+	m68ki_cpu.jit = NULL;
+#endif
+#if M68K_DECODE_CACHE || M68K_JIT
+	m68ki_cpu.saved = 0;
+#endif
+}
+
+void m68k_set_direct_ram(unsigned char *base, unsigned int size)
+{
+#if M68K_DIRECT_RAM
+	m68ki_cpu.direct_ram = base;
+	m68ki_cpu.direct_ram_size = (base) ? size : 0;
+#else
+	(void)base;
+	(void)size;
+#endif
+}
+
+void m68k_invalidate_decode_cache(void)
+{
+#if M68K_DECODE_CACHE
+	m68ki_cpu.decode_generation++;
+#endif
+#if M68K_JIT
+	if(m68ki_cpu.jit)
+		m68ki_jit_flush();
+#endif
 }
 
 /* Trigger a Bus Error exception */
 void m68k_pulse_bus_error(void)
 {
+#if M68K_EMULATE_BUS_ERROR
 	m68ki_exception_bus_error();
+#endif
 }
 
 /* Pulse the RESET line on the CPU */
@@ -1158,15 +1268,54 @@ unsigned int m68k_context_size()
 
 unsigned int m68k_get_context(void* dst)
 {
+#if M68K_DECODE_CACHE || M68K_JIT
+	if(dst) m68ki_cpu.saved = 1;
+#endif
 	if(dst) *(m68ki_cpu_core*)dst = m68ki_cpu;
 	return sizeof(m68ki_cpu_core);
 }
 
+void m68k_free_context(void* ctx)
+{
+	m68ki_cpu_core* cpu = (m68ki_cpu_core*)ctx;
+
+	(void)cpu;
+#if M68K_DECODE_CACHE
+	free(cpu->decode_cache);
+	cpu->decode_cache = NULL;
+#endif
+#if M68K_JIT
+	if(cpu->jit)
+		m68ki_jit_free(cpu->jit);
+	cpu->jit = NULL;
+#endif
+}
+
 void m68k_set_context(void* src)
 {
 	if(src) m68ki_cpu = *(m68ki_cpu_core*)src;
 }
 
+void m68k_set_user_data(void* data)
+{
+	m68ki_cpu.user_data = data;
+}
+
+void* m68k_get_user_data(void)
+{
+	return m68ki_cpu.user_data;
+}
+
+int m68k_execute_ctx(void* ctx, int num_cycles)
+{
+	int cycles;
+
+	m68k_set_context(ctx);
+	cycles = m68k_execute(num_cycles);
+	m68k_get_context(ctx);
+	return cycles;
+}
+
 /* ======================================================================== */
 /* ============================== MAME STUFF ============================== */
 /* ======================================================================== */
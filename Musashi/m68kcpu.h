@@ -605,7 +605,7 @@ typedef uint32 uint64;
 
 /* sigjmp() on Mac OS X and *BSD in general saves signal contexts and is super-slow, use sigsetjmp() to tell it not to */
 #ifdef _BSD_SETJMP_H
-extern sigjmp_buf m68ki_aerr_trap;
+extern M68K_TLS sigjmp_buf m68ki_aerr_trap;
 #define m68ki_set_address_error_trap(m68k) \
 	if(sigsetjmp(m68ki_aerr_trap, 0) != 0) \
 	{ \
@@ -627,7 +627,7 @@ extern sigjmp_buf m68ki_aerr_trap;
 		siglongjmp(m68ki_aerr_trap, 1); \
 	}
 #else
-extern jmp_buf m68ki_aerr_trap;
+extern M68K_TLS jmp_buf m68ki_aerr_trap;
 	#define m68ki_set_address_error_trap() \
 		if(setjmp(m68ki_aerr_trap) != 0) \
 		{ \
@@ -870,11 +870,20 @@ extern jmp_buf m68ki_aerr_trap;
 
 /* ---------------------------- Cycle Counting ---------------------------- */
 
+#if M68K_INSTRUCTION_BUDGET
+/* Every instruction uses 1 of the budget, whatever its timing */
+#define ADD_CYCLES(A)    ((void)0)
+#define USE_CYCLES(A)    ((void)0)
+#define USE_INSTRUCTION_CYCLES(A) m68ki_remaining_cycles--
+#define USE_ALL_CYCLES() m68ki_remaining_cycles = 1
+#else
 #define ADD_CYCLES(A)    m68ki_remaining_cycles += (A)
 #define USE_CYCLES(A)    m68ki_remaining_cycles -= (A)
+#define USE_INSTRUCTION_CYCLES(A) USE_CYCLES(A)
+#define USE_ALL_CYCLES() m68ki_remaining_cycles %= CYC_INSTRUCTION[REG_IR]
+#endif /* M68K_INSTRUCTION_BUDGET */
 #define SET_CYCLES(A)    m68ki_remaining_cycles = A
 #define GET_CYCLES()     m68ki_remaining_cycles
-#define USE_ALL_CYCLES() m68ki_remaining_cycles %= CYC_INSTRUCTION[REG_IR]
 
 
 
@@ -923,6 +932,57 @@ typedef union
 	double f;
 } fp_reg;
 
+#if M68K_68000_ONLY
+#if M68K_EMULATE_010 || M68K_EMULATE_EC020 || M68K_EMULATE_020 || M68K_EMULATE_030 || M68K_EMULATE_040
+#error M68K_68000_ONLY needs M68K_EMULATE_010, EC020, 020, 030 and 040 OFF
+#endif
+#endif
+
+#if M68K_DECODE_CACHE
+#if !M68K_DIRECT_RAM || M68K_EMULATE_PREFETCH || M68K_INSTRUCTION_HOOK
+#error M68K_DECODE_CACHE needs M68K_DIRECT_RAM, and no M68K_EMULATE_PREFETCH or M68K_INSTRUCTION_HOOK
+#endif
+
+/* One decoded opcode, direct-mapped by address */
+#define M68K_DECODE_CACHE_SIZE 8192
+
+typedef struct m68ki_decode_entry
+{
+	uint pc;                /* address of the opcode word */
+	uint generation;        /* valid if equal to the CPU's decode_generation */
+	void (*handler)(void);
+	uint16 ir;
+	uint8 cycles;
+} m68ki_decode_entry;
+
+#define M68K_DECODE_CACHE_INDEX(A) (((A) >> 1) & (M68K_DECODE_CACHE_SIZE-1))
+#endif /* M68K_DECODE_CACHE */
+
+#if M68K_JIT
+#if !M68K_DIRECT_RAM || M68K_EMULATE_PREFETCH || M68K_INSTRUCTION_HOOK || M68K_EMULATE_TRACE || M68K_EMULATE_BUS_ERROR
+#error M68K_JIT needs M68K_DIRECT_RAM, and no M68K_EMULATE_PREFETCH, M68K_INSTRUCTION_HOOK, M68K_EMULATE_TRACE or M68K_EMULATE_BUS_ERROR
+#endif
+
+/* Writes to a page of the direct RAM that compiled opcodes came from
+ * throw away all of the compiled code
+ */
+#define M68K_JIT_PAGE_SHIFT 8
+
+typedef struct m68ki_jit_state
+{
+	int mode;                       /* M68K_JIT_ON or M68K_JIT_VERIFY */
+	uint generation;                /* blocks of older generations are stale */
+	unsigned char dirty;            /* set when the running block may be stale */
+	uint* code_pages;               /* generation each page was compiled in */
+	uint code_page_count;
+	unsigned char* code;            /* executable buffer for compiled blocks */
+	uint code_used;
+	struct m68ki_jit_block* blocks;
+	struct m68ki_jit_log* logs;     /* one for each run in M68K_JIT_VERIFY mode */
+	struct m68ki_jit_log* log;      /* where writes are recorded, or NULL */
+} m68ki_jit_state;
+#endif /* M68K_JIT */
+
 typedef struct
 {
 	uint cpu_type;     /* CPU Type: 68000, 68008, 68010, 68EC020, 68020, 68EC030, 68030, 68EC040, or 68040 */
@@ -1001,22 +1061,38 @@ typedef struct
 	void (*set_fc_callback)(unsigned int new_fc);     /* Called when the CPU function code changes */
 	void (*instr_hook_callback)(unsigned int pc);     /* Called every instruction cycle prior to execution */
 
+#if M68K_DIRECT_RAM
+	unsigned char* direct_ram;      /* host memory for addresses 0 to direct_ram_size */
+	uint direct_ram_size;
+#endif
+#if M68K_DECODE_CACHE
+	struct m68ki_decode_entry* decode_cache;  /* M68K_DECODE_CACHE_SIZE entries */
+	uint decode_generation;                   /* entries from older generations are stale */
+#endif
+#if M68K_DECODE_CACHE || M68K_JIT
+	uint saved;                               /* a context has a copy and owns the allocations */
+#endif
+#if M68K_JIT
+	struct m68ki_jit_state* jit;              /* NULL unless m68k_set_jit() turned it on */
+#endif
+	void* user_data;                          /* see m68k_set_user_data() */
+
 } m68ki_cpu_core;
 
 
-extern m68ki_cpu_core m68ki_cpu;
-extern sint           m68ki_remaining_cycles;
-extern uint           m68ki_tracing;
+extern M68K_TLS m68ki_cpu_core m68ki_cpu;
+extern M68K_TLS sint           m68ki_remaining_cycles;
+extern M68K_TLS uint           m68ki_tracing;
 extern const uint8    m68ki_shift_8_table[];
 extern const uint16   m68ki_shift_16_table[];
 extern const uint     m68ki_shift_32_table[];
 extern const uint8    m68ki_exception_cycle_table[][256];
-extern uint           m68ki_address_space;
+extern M68K_TLS uint           m68ki_address_space;
 extern const uint8    m68ki_ea_idx_cycle_table[];
 
-extern uint           m68ki_aerr_address;
-extern uint           m68ki_aerr_write_mode;
-extern uint           m68ki_aerr_fc;
+extern M68K_TLS uint           m68ki_aerr_address;
+extern M68K_TLS uint           m68ki_aerr_write_mode;
+extern M68K_TLS uint           m68ki_aerr_fc;
 
 /* Forward declarations to keep some of the macros happy */
 static inline uint m68ki_read_16_fc (uint address, uint fc);
@@ -1119,6 +1195,84 @@ static inline uint m68ki_read_imm_32(void)
 
 /* ------------------------- Top level read/write ------------------------- */
 
+#if M68K_DIRECT_RAM
+/* True if bytes at address are all inside the direct RAM, written so that it
+ * cannot wrap when the address bus is 32 bits wide
+ */
+#define M68KI_DIRECT_RAM_HAS(address, bytes) \
+	((address) < m68ki_cpu.direct_ram_size && m68ki_cpu.direct_ram_size - (address) >= (bytes))
+
+/* Big-endian loads and stores on the host memory given to m68k_set_direct_ram() */
+static inline uint m68ki_direct_read_8(const unsigned char* p)
+{
+	return p[0];
+}
+static inline uint m68ki_direct_read_16(const unsigned char* p)
+{
+	return (p[0] << 8) | p[1];
+}
+static inline uint m68ki_direct_read_32(const unsigned char* p)
+{
+	return ((uint)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+static inline void m68ki_direct_write_8(unsigned char* p, uint value)
+{
+	p[0] = (unsigned char)value;
+}
+static inline void m68ki_direct_write_16(unsigned char* p, uint value)
+{
+	p[0] = (unsigned char)(value >> 8);
+	p[1] = (unsigned char)value;
+}
+static inline void m68ki_direct_write_32(unsigned char* p, uint value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+#endif /* M68K_DIRECT_RAM */
+
+#if M68K_DECODE_CACHE
+/* A write of size bytes at address may have changed cached opcodes */
+static inline void m68ki_decode_cache_write(uint address, uint size)
+{
+	m68ki_decode_entry* cache = m68ki_cpu.decode_cache;
+	uint a;
+
+	if(!cache)
+		return;
+	for(a = address & ~1; a < address + size; a += 2)
+	{
+		m68ki_decode_entry* entry = &cache[M68K_DECODE_CACHE_INDEX(a)];
+		if(entry->pc == a)
+			entry->generation = 0;
+	}
+}
+#endif /* M68K_DECODE_CACHE */
+
+#if M68K_JIT
+void m68ki_jit_flush(void);
+void m68ki_jit_log_write(uint address, uint size, uint value);
+
+/* A write of size bytes at address may have changed compiled opcodes */
+static inline void m68ki_jit_write(uint address, uint size, uint value)
+{
+	m68ki_jit_state* jit = m68ki_cpu.jit;
+	uint last;
+
+	if(!jit)
+		return;
+	last = (address + size - 1) >> M68K_JIT_PAGE_SHIFT;
+	if(last < jit->code_page_count &&
+	   (jit->code_pages[address >> M68K_JIT_PAGE_SHIFT] == jit->generation ||
+	    jit->code_pages[last] == jit->generation))
+		m68ki_jit_flush();
+	if(jit->log)
+		m68ki_jit_log_write(address, size, value);
+}
+#endif /* M68K_JIT */
+
 /* Handles all memory accesses (except for immediate reads if they are
  * configured to use separate functions in m68kconf.h).
  * All memory accesses must go through these top level functions.
@@ -1135,6 +1289,11 @@ static inline uint m68ki_read_8_fc(uint address, uint fc)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_DIRECT_RAM
+	address = ADDRESS_68K(address);
+	if(M68KI_DIRECT_RAM_HAS(address, 1))
+		return m68ki_direct_read_8(m68ki_cpu.direct_ram + address);
+#endif
 	return m68k_read_memory_8(ADDRESS_68K(address));
 }
 static inline uint m68ki_read_16_fc(uint address, uint fc)
@@ -1148,6 +1307,11 @@ static inline uint m68ki_read_16_fc(uint address, uint fc)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_DIRECT_RAM
+	address = ADDRESS_68K(address);
+	if(M68KI_DIRECT_RAM_HAS(address, 2))
+		return m68ki_direct_read_16(m68ki_cpu.direct_ram + address);
+#endif
 	return m68k_read_memory_16(ADDRESS_68K(address));
 }
 static inline uint m68ki_read_32_fc(uint address, uint fc)
@@ -1161,6 +1325,11 @@ static inline uint m68ki_read_32_fc(uint address, uint fc)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_DIRECT_RAM
+	address = ADDRESS_68K(address);
+	if(M68KI_DIRECT_RAM_HAS(address, 4))
+		return m68ki_direct_read_32(m68ki_cpu.direct_ram + address);
+#endif
 	return m68k_read_memory_32(ADDRESS_68K(address));
 }
 
@@ -1174,6 +1343,20 @@ static inline void m68ki_write_8_fc(uint address, uint fc, uint value)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_DIRECT_RAM
+	address = ADDRESS_68K(address);
+	if(M68KI_DIRECT_RAM_HAS(address, 1))
+	{
+#if M68K_DECODE_CACHE
+		m68ki_decode_cache_write(address, 1);
+#endif
+#if M68K_JIT
+		m68ki_jit_write(address, 1, value);
+#endif
+		m68ki_direct_write_8(m68ki_cpu.direct_ram + address, value);
+		return;
+	}
+#endif
 	m68k_write_memory_8(ADDRESS_68K(address), value);
 }
 static inline void m68ki_write_16_fc(uint address, uint fc, uint value)
@@ -1187,6 +1370,20 @@ static inline void m68ki_write_16_fc(uint address, uint fc, uint value)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_DIRECT_RAM
+	address = ADDRESS_68K(address);
+	if(M68KI_DIRECT_RAM_HAS(address, 2))
+	{
+#if M68K_DECODE_CACHE
+		m68ki_decode_cache_write(address, 2);
+#endif
+#if M68K_JIT
+		m68ki_jit_write(address, 2, value);
+#endif
+		m68ki_direct_write_16(m68ki_cpu.direct_ram + address, value);
+		return;
+	}
+#endif
 	m68k_write_memory_16(ADDRESS_68K(address), value);
 }
 static inline void m68ki_write_32_fc(uint address, uint fc, uint value)
@@ -1200,6 +1397,20 @@ static inline void m68ki_write_32_fc(uint address, uint fc, uint value)
 	    address = pmmu_translate_addr(address);
 #endif
 
+#if M68K_DIRECT_RAM
+	address = ADDRESS_68K(address);
+	if(M68KI_DIRECT_RAM_HAS(address, 4))
+	{
+#if M68K_DECODE_CACHE
+		m68ki_decode_cache_write(address, 4);
+#endif
+#if M68K_JIT
+		m68ki_jit_write(address, 4, value);
+#endif
+		m68ki_direct_write_32(m68ki_cpu.direct_ram + address, value);
+		return;
+	}
+#endif
 	m68k_write_memory_32(ADDRESS_68K(address), value);
 }
 
@@ -1907,7 +2118,8 @@ static inline void m68ki_exception_privilege_violation(void)
 	USE_CYCLES(CYC_EXCEPTION[EXCEPTION_PRIVILEGE_VIOLATION] - CYC_INSTRUCTION[REG_IR]);
 }
 
-extern jmp_buf m68ki_bus_error_jmp_buf;
+#if M68K_EMULATE_BUS_ERROR
+extern M68K_TLS jmp_buf m68ki_bus_error_jmp_buf;
 
 #define m68ki_check_bus_error_trap() setjmp(m68ki_bus_error_jmp_buf)
 
@@ -1946,6 +2158,9 @@ static inline void m68ki_exception_bus_error(void)
 
 	longjmp(m68ki_bus_error_jmp_buf, 1);
 }
+#else
+#define m68ki_check_bus_error_trap()
+#endif /* M68K_EMULATE_BUS_ERROR */
 
 extern int cpu_log_enabled;
 
@@ -1999,7 +2214,17 @@ static inline void m68ki_exception_illegal(void)
 				 m68ki_cpu_names[CPU_TYPE], ADDRESS_68K(REG_PPC), REG_IR,
 				 m68ki_disassemble_quick(ADDRESS_68K(REG_PPC))));
 	if (m68ki_illg_callback(REG_IR))
+	{
+#if M68K_DECODE_CACHE
+		/* the host may have written anything, code included */
+		m68ki_cpu.decode_generation++;
+#endif
+#if M68K_JIT
+		if(m68ki_cpu.jit)
+			m68ki_jit_flush();
+#endif
 	    return;
+	}
 
 	sr = m68ki_init_exception();
 
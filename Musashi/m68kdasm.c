@@ -38,6 +38,10 @@
 #include <string.h>
 #include "m68k.h"
 
+#if M68K_THREAD_LOCAL
+#include <pthread.h>
+#endif
+
 #ifndef uint32
 #define uint32 uint
 #endif
@@ -209,19 +213,23 @@ typedef struct
 /* Opcode handler jump table */
 static void (*g_instruction_table[0x10000])(void);
 /* Flag if disassembler initialized */
+#if M68K_THREAD_LOCAL
+static pthread_once_t g_initialized = PTHREAD_ONCE_INIT;
+#else
 static int  g_initialized = 0;
+#endif
 
 /* Address mask to simulate address lines */
-static unsigned int g_address_mask = 0xffffffff;
+static M68K_TLS unsigned int g_address_mask = 0xffffffff;
 
-static char g_dasm_str[100]; /* string to hold disassembly */
-static char g_helper_str[100]; /* string to hold helpful info */
-static uint g_cpu_pc;        /* program counter */
-static uint g_cpu_ir;        /* instruction register */
-static uint g_cpu_type;
-static uint g_opcode_type;
-static const unsigned char* g_rawop;
-static uint g_rawbasepc;
+static M68K_TLS char g_dasm_str[100]; /* string to hold disassembly */
+static M68K_TLS char g_helper_str[100]; /* string to hold helpful info */
+static M68K_TLS uint g_cpu_pc;        /* program counter */
+static M68K_TLS uint g_cpu_ir;        /* instruction register */
+static M68K_TLS uint g_cpu_type;
+static M68K_TLS uint g_opcode_type;
+static M68K_TLS const unsigned char* g_rawop;
+static M68K_TLS uint g_rawbasepc;
 
 /* used by ops like asr, ror, addq, etc */
 static const uint g_3bit_qdata_table[8] = {8, 1, 2, 3, 4, 5, 6, 7};
@@ -3724,11 +3732,15 @@ static void build_opcode_table(void)
 /* Disasemble one instruction at pc and store in str_buff */
 unsigned int m68k_disassemble(char* str_buff, unsigned int pc, unsigned int cpu_type)
 {
+#if M68K_THREAD_LOCAL
+	pthread_once(&g_initialized, build_opcode_table);
+#else
 	if(!g_initialized)
 	{
 		build_opcode_table();
 		g_initialized = 1;
 	}
+#endif
 	switch(cpu_type)
 	{
 		case M68K_CPU_TYPE_68000:
@@ -3794,11 +3806,15 @@ unsigned int m68k_disassemble_raw(char* str_buff, unsigned int pc, const unsigne
 /* Check if the instruction is a valid one */
 unsigned int m68k_is_valid_instruction(unsigned int instruction, unsigned int cpu_type)
 {
+#if M68K_THREAD_LOCAL
+	pthread_once(&g_initialized, build_opcode_table);
+#else
 	if(!g_initialized)
 	{
 		build_opcode_table();
 		g_initialized = 1;
 	}
+#endif
 
 	instruction &= 0xffff;
 	if(g_instruction_table[instruction] == d68000_illegal)
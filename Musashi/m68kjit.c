@@ -0,0 +1,554 @@
+/* ======================================================================== */
+/* ======================= CALL-THREADED BLOCK CACHE ====================== */
+/* ======================================================================== */
+/*
+ * Included by m68kcpu.c, like m68kfpu.c.
+ *
+ * The block cache does not translate 68k instructions into host instructions,
+ * it removes the fetch and decode of the interpreter loop instead.  A block
+ * is compiled into x86-64 code that, for every opcode, stores REG_PPC, REG_IR
+ * and REG_PC as constants, calls the opcode handler directly and subtracts
+ * its cycles.  After each handler the block checks that the PC is where the
+ * next opcode was expected, that no compiled code has been overwritten and
+ * that there are cycles left, and returns to m68k_execute() otherwise.  A
+ * block that branches back to its own start loops without returning.
+ *
+ * The flags are still computed by the handlers, so the state of the CPU
+ * between two instructions is exactly that of the interpreter, exceptions
+ * included.  Opcodes that call back to the host (illegal, line 1010 and 1111,
+ * RESET, BKPT) and STOP are never compiled, and are left to the interpreter.
+ *
+ * The code buffer is mapped read and write, and made read and execute again
+ * once a block has been written, so it is never writable and executable at
+ * the same time.
+ */
+
+#if M68K_JIT
+
+#if defined(__x86_64__)
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define M68K_JIT_BLOCKS           4096     /* direct-mapped by address */
+#define M68K_JIT_BLOCK_INDEX(A)   (((A) >> 1) & (M68K_JIT_BLOCKS-1))
+#define M68K_JIT_HOT              8        /* executions before a block is compiled */
+#define M68K_JIT_MAX_INSTRUCTIONS 64
+#define M68K_JIT_CODE_SIZE        (1024*1024)
+/* bytes emitted by m68ki_jit_compile(): per opcode 3 stores of 10, mov rax
+ * 10, call 2, sub 8, mov eax 5, and the PC, dirty and cycles checks of 16, 11
+ * and 11, per block the prologue of 21, the final jmp of 5, the loop back to
+ * the start of 46 and the epilogue of 13
+ */
+#define M68K_JIT_OPCODE_SIZE      93
+#define M68K_JIT_BLOCK_OVERHEAD   85
+#define M68K_JIT_MAX_BLOCK_SIZE   (M68K_JIT_BLOCK_OVERHEAD + M68K_JIT_MAX_INSTRUCTIONS*M68K_JIT_OPCODE_SIZE)
+#define M68K_JIT_LOG_SIZE         4096
+
+/* returns the number of instructions executed */
+typedef int (*m68ki_jit_code)(m68ki_cpu_core* cpu, sint* cycles, unsigned char* dirty);
+
+struct m68ki_jit_block
+{
+	uint pc;
+	uint generation;    /* valid if equal to the generation of the cache */
+	uint hits;          /* M68K_JIT_HOT once compiled, or given up on */
+	m68ki_jit_code code;
+};
+
+struct m68ki_jit_write
+{
+	uint address;
+	uint size;
+	uint value;
+	uint old;
+};
+
+struct m68ki_jit_log
+{
+	uint count;
+	uint overflow;
+	struct m68ki_jit_write writes[M68K_JIT_LOG_SIZE];
+};
+
+/* The compiled code of all blocks is stale */
+void m68ki_jit_flush(void)
+{
+	m68ki_jit_state* jit = m68ki_cpu.jit;
+
+	jit->generation++;
+	jit->code_used = 0;
+	jit->dirty = 1;
+}
+
+void m68ki_jit_log_write(uint address, uint size, uint value)
+{
+	struct m68ki_jit_log* log = m68ki_cpu.jit->log;
+	struct m68ki_jit_write* write;
+	unsigned char* p = m68ki_cpu.direct_ram + address;
+
+	if(log->count == M68K_JIT_LOG_SIZE)
+	{
+		log->overflow = 1;
+		return;
+	}
+	write = &log->writes[log->count++];
+	write->address = address;
+	write->size = size;
+	write->value = value;
+	write->old = (size == 1) ? m68ki_direct_read_8(p) : (size == 2) ? m68ki_direct_read_16(p) : m68ki_direct_read_32(p);
+}
+
+/* Opcodes that are left to the interpreter */
+static int m68ki_jit_can_compile(uint ir)
+{
+	void (*handler)(void) = m68ki_instruction_handler(ir);
+
+	return handler != m68ki_instruction_handler(0x4afc)   /* illegal */
+		&& handler != m68ki_instruction_handler(0xa000)   /* line 1010 */
+		&& handler != m68ki_instruction_handler(0xf000)   /* line 1111 */
+		&& handler != m68ki_instruction_handler(0x4e70)   /* reset */
+		&& handler != m68ki_instruction_handler(0x4e72)   /* stop */
+		&& (ir & 0xfff8) != 0x4848;                         /* bkpt */
+}
+
+static unsigned char* m68ki_jit_emit_32(unsigned char* p, uint value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+	return p + 4;
+}
+
+static unsigned char* m68ki_jit_emit_64(unsigned char* p, uint64 value)
+{
+	p = m68ki_jit_emit_32(p, (uint)value);
+	return m68ki_jit_emit_32(p, (uint)(value >> 32));
+}
+
+/* mov dword [rbx+offset], value */
+static unsigned char* m68ki_jit_emit_store(unsigned char* p, uint offset, uint value)
+{
+	*p++ = 0xc7;
+	*p++ = 0x83;
+	p = m68ki_jit_emit_32(p, offset);
+	return m68ki_jit_emit_32(p, value);
+}
+
+/* jcc rel32 (or jmp if cc is 0), to be patched */
+static unsigned char* m68ki_jit_emit_jump(unsigned char* p, uint cc, unsigned char** patch)
+{
+	if(cc)
+	{
+		*p++ = 0x0f;
+		*p++ = cc;
+	}
+	else
+		*p++ = 0xe9;
+	*patch = p;
+	return m68ki_jit_emit_32(p, 0);
+}
+
+static void m68ki_jit_patch(unsigned char* patch, unsigned char* target)
+{
+	m68ki_jit_emit_32(patch, (uint)(target - (patch + 4)));
+}
+
+/* cmp dword [rbx+offsetof(pc)], pc */
+static unsigned char* m68ki_jit_emit_cmp_pc(unsigned char* p, uint pc)
+{
+	*p++ = 0x81;
+	*p++ = 0xbb;
+	p = m68ki_jit_emit_32(p, offsetof(m68ki_cpu_core, pc));
+	return m68ki_jit_emit_32(p, pc);
+}
+
+/* cmp byte [r13], 0 and cmp dword [r12], 0 */
+static unsigned char* m68ki_jit_emit_cmp_dirty(unsigned char* p)
+{
+	static const unsigned char code[] = {0x41, 0x80, 0x7d, 0x00, 0x00};
+	memcpy(p, code, sizeof(code));
+	return p + sizeof(code);
+}
+
+static unsigned char* m68ki_jit_emit_cmp_cycles(unsigned char* p)
+{
+	static const unsigned char code[] = {0x41, 0x83, 0x3c, 0x24, 0x00};
+	memcpy(p, code, sizeof(code));
+	return p + sizeof(code);
+}
+
+/* Compile the block starting at pc, returns NULL if its first opcode cannot
+ * be compiled
+ */
+static m68ki_jit_code m68ki_jit_compile(uint start)
+{
+	static const unsigned char prologue[] =
+	{
+		0x53,                   /* push rbx */
+		0x41, 0x54,             /* push r12 */
+		0x41, 0x55,             /* push r13 */
+		0x41, 0x56,             /* push r14 */
+		0x41, 0x57,             /* push r15, keeps the stack aligned */
+		0x48, 0x89, 0xfb,       /* mov rbx, rdi (cpu) */
+		0x49, 0x89, 0xf4,       /* mov r12, rsi (cycles) */
+		0x49, 0x89, 0xd5,       /* mov r13, rdx (dirty) */
+		0x45, 0x31, 0xf6        /* xor r14d, r14d (instructions of earlier loops) */
+	};
+	static const unsigned char epilogue[] =
+	{
+		0x44, 0x01, 0xf0,       /* add eax, r14d */
+		0x41, 0x5f,             /* pop r15 */
+		0x41, 0x5e,             /* pop r14 */
+		0x41, 0x5d,             /* pop r13 */
+		0x41, 0x5c,             /* pop r12 */
+		0x5b,                   /* pop rbx */
+		0xc3                    /* ret */
+	};
+	m68ki_jit_state* jit = m68ki_cpu.jit;
+	unsigned char* code = jit->code + jit->code_used;
+	unsigned char* p = code;
+	unsigned char* body;
+	unsigned char* loop;
+	m68ki_jit_code entry;
+	unsigned char* exits[M68K_JIT_MAX_INSTRUCTIONS*2 + 3];
+	unsigned char* loops[M68K_JIT_MAX_INSTRUCTIONS];
+	uint exit_count = 0;
+	uint loop_count = 0;
+	uint limit = jit->code_page_count << M68K_JIT_PAGE_SHIFT;
+	uint cpu_type = m68k_get_reg(NULL, M68K_REG_CPU_TYPE);
+	uint count = 0;
+	uint pc = start;
+	uint i;
+	char buff[100];
+
+	memcpy(p, prologue, sizeof(prologue));
+	p += sizeof(prologue);
+	body = p;
+
+	while(count < M68K_JIT_MAX_INSTRUCTIONS && pc < limit && limit - pc >= 2)
+	{
+		uint ir = m68ki_direct_read_16(m68ki_cpu.direct_ram + pc);
+		uint next;
+
+		if(!m68ki_jit_can_compile(ir))
+			break;
+		/* a wrong length only ends the block early, the PC is checked */
+		next = pc + m68k_disassemble(buff, pc, cpu_type);
+
+		p = m68ki_jit_emit_store(p, offsetof(m68ki_cpu_core, ppc), pc);
+		p = m68ki_jit_emit_store(p, offsetof(m68ki_cpu_core, ir), ir);
+		p = m68ki_jit_emit_store(p, offsetof(m68ki_cpu_core, pc), pc + 2);
+		*p++ = 0x48;            /* mov rax, handler */
+		*p++ = 0xb8;
+		p = m68ki_jit_emit_64(p, (uint64)(size_t)m68ki_instruction_handler(ir));
+		*p++ = 0xff;            /* call rax */
+		*p++ = 0xd0;
+		*p++ = 0x41;            /* sub dword [r12], cycles */
+		*p++ = 0x81;
+		*p++ = 0x2c;
+		*p++ = 0x24;
+#if M68K_INSTRUCTION_BUDGET
+		p = m68ki_jit_emit_32(p, 1);
+#else
+		p = m68ki_jit_emit_32(p, CYC_INSTRUCTION[ir]);
+#endif
+		*p++ = 0xb8;            /* mov eax, instructions so far */
+		p = m68ki_jit_emit_32(p, count + 1);
+		p = m68ki_jit_emit_cmp_pc(p, next);
+		p = m68ki_jit_emit_jump(p, 0x85, &loops[loop_count++]);
+		p = m68ki_jit_emit_cmp_dirty(p);
+		p = m68ki_jit_emit_jump(p, 0x85, &exits[exit_count++]);
+		p = m68ki_jit_emit_cmp_cycles(p);
+		p = m68ki_jit_emit_jump(p, 0x8e, &exits[exit_count++]);
+
+		jit->code_pages[pc >> M68K_JIT_PAGE_SHIFT] = jit->generation;
+		jit->code_pages[(pc + 1) >> M68K_JIT_PAGE_SHIFT] = jit->generation;
+		count++;
+		pc = next;
+	}
+	if(!count)
+		return NULL;
+	p = m68ki_jit_emit_jump(p, 0, &exits[exit_count++]);
+
+	/* The PC is not that of the next opcode, loop if it is the start of the
+	 * block, unless the results are being verified one block at a time
+	 */
+	loop = p;
+	if(jit->mode != M68K_JIT_VERIFY)
+	{
+		p = m68ki_jit_emit_cmp_pc(p, start);
+		p = m68ki_jit_emit_jump(p, 0x85, &exits[exit_count++]);
+		p = m68ki_jit_emit_cmp_dirty(p);
+		p = m68ki_jit_emit_jump(p, 0x85, &exits[exit_count++]);
+		p = m68ki_jit_emit_cmp_cycles(p);
+		p = m68ki_jit_emit_jump(p, 0x8e, &exits[exit_count++]);
+		*p++ = 0x41;            /* add r14d, eax */
+		*p++ = 0x01;
+		*p++ = 0xc6;
+		p = m68ki_jit_emit_jump(p, 0, &loops[loop_count]);
+		m68ki_jit_patch(loops[loop_count], body);
+	}
+
+	for(i = 0; i < loop_count; i++)
+		m68ki_jit_patch(loops[i], loop);
+	for(i = 0; i < exit_count; i++)
+		m68ki_jit_patch(exits[i], p);
+	memcpy(p, epilogue, sizeof(epilogue));
+	p += sizeof(epilogue);
+
+	/* only M68K_JIT_MAX_BLOCK_SIZE bytes were made writable */
+	assert(p - code <= M68K_JIT_MAX_BLOCK_SIZE);
+	jit->code_used += p - code;
+	/* ISO C has no cast from data to function pointers */
+	memcpy(&entry, &code, sizeof(entry));
+	return entry;
+}
+
+/* Run the compiled block and then the interpreter over the same opcodes, and
+ * compare the results
+ */
+static int m68ki_jit_verify(m68ki_jit_code code)
+{
+	m68ki_jit_state* jit = m68ki_cpu.jit;
+	struct m68ki_jit_log* jit_log = &jit->logs[0];
+	struct m68ki_jit_log* interpreter_log = &jit->logs[1];
+	m68ki_cpu_core start = m68ki_cpu;
+	sint start_cycles = GET_CYCLES();
+	int start_initial_cycles = m68ki_initial_cycles;
+	m68ki_cpu_core result;
+	sint result_cycles;
+	int result_initial_cycles;
+	int count;
+	int i;
+
+	jit_log->count = jit_log->overflow = 0;
+	jit->log = jit_log;
+	jit->dirty = 0;
+	count = code(&m68ki_cpu, &m68ki_remaining_cycles, &jit->dirty);
+	jit->log = NULL;
+
+	result = m68ki_cpu;
+	result_cycles = GET_CYCLES();
+	result_initial_cycles = m68ki_initial_cycles;
+	for(i = jit_log->count - 1; i >= 0; i--)
+	{
+		struct m68ki_jit_write* write = &jit_log->writes[i];
+		unsigned char* p = m68ki_cpu.direct_ram + write->address;
+
+		if(write->size == 1)
+			m68ki_direct_write_8(p, write->old);
+		else if(write->size == 2)
+			m68ki_direct_write_16(p, write->old);
+		else
+			m68ki_direct_write_32(p, write->old);
+	}
+	m68ki_cpu = start;
+	SET_CYCLES(start_cycles);
+	m68ki_initial_cycles = start_initial_cycles;
+
+	interpreter_log->count = interpreter_log->overflow = 0;
+	jit->log = interpreter_log;
+	for(i = 0; i < count; i++)
+		m68ki_execute_instruction();
+	jit->log = NULL;
+
+	if(memcmp(result.dar, REG_DA, sizeof(result.dar)) ||
+	   memcmp(result.sp, REG_SP_BASE, sizeof(result.sp)) ||
+	   result.pc != REG_PC || result.ppc != REG_PPC || result.ir != REG_IR ||
+	   result.x_flag != FLAG_X || result.n_flag != FLAG_N ||
+	   result.not_z_flag != FLAG_Z || result.v_flag != FLAG_V ||
+	   result.c_flag != FLAG_C || result.s_flag != FLAG_S ||
+	   result.m_flag != FLAG_M || result.int_mask != FLAG_INT_MASK ||
+	   result.stopped != CPU_STOPPED || result_cycles != GET_CYCLES() ||
+	   result_initial_cycles != m68ki_initial_cycles)
+	{
+		fprintf(stderr, "m68k jit: block at %08x differs from the interpreter after %d instructions, pc %08x should be %08x, cycles %d should be %d\n",
+				start.pc, count, result.pc, REG_PC, result_cycles, GET_CYCLES());
+		for(i = 0; i < 16; i++)
+			if(result.dar[i] != REG_DA[i])
+				fprintf(stderr, "m68k jit: %c%d %08x should be %08x\n", (i < 8) ? 'd' : 'a', i & 7, result.dar[i], REG_DA[i]);
+		abort();
+	}
+	if(jit_log->overflow || interpreter_log->overflow || jit_log->count != interpreter_log->count)
+	{
+		fprintf(stderr, "m68k jit: block at %08x made %u writes, the interpreter %u\n",
+				start.pc, jit_log->count, interpreter_log->count);
+		abort();
+	}
+	for(i = 0; i < (int)jit_log->count; i++)
+	{
+		struct m68ki_jit_write* a = &jit_log->writes[i];
+		struct m68ki_jit_write* b = &interpreter_log->writes[i];
+
+		if(a->address != b->address || a->size != b->size || a->value != b->value)
+		{
+			fprintf(stderr, "m68k jit: block at %08x wrote %08x to %08x (%u bytes), the interpreter %08x to %08x (%u bytes)\n",
+					start.pc, a->value, a->address, a->size, b->value, b->address, b->size);
+			abort();
+		}
+	}
+	return count;
+}
+
+/* Change the protection of the pages of the code buffer that hold size bytes
+ * at start, returns 0 if the system refuses
+ */
+static int m68ki_jit_protect(unsigned char* start, size_t size, int prot)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t offset = (size_t)start & (page - 1);
+
+	return mprotect(start - offset, (size + offset + page - 1) & ~(page - 1), prot) == 0;
+}
+
+/* Execute the block at REG_PC if it has been compiled, returns the number of
+ * instructions executed, or 0 to leave the next instruction to the
+ * interpreter
+ */
+static int m68ki_jit_execute(void)
+{
+	m68ki_jit_state* jit = m68ki_cpu.jit;
+	uint pc = REG_PC;
+	struct m68ki_jit_block* block;
+	unsigned char* code;
+
+	/* also leaves addresses with bits above the address bus to the
+	 * interpreter, the compiled code stores the PC as it was compiled */
+	if(pc >= (jit->code_page_count << M68K_JIT_PAGE_SHIFT))
+		return 0;
+
+	block = &jit->blocks[M68K_JIT_BLOCK_INDEX(pc)];
+	if(block->pc != pc || block->generation != jit->generation)
+	{
+		block->pc = pc;
+		block->generation = jit->generation;
+		block->hits = 0;
+		block->code = NULL;
+	}
+	if(block->hits < M68K_JIT_HOT)
+	{
+		if(++block->hits < M68K_JIT_HOT)
+			return 0;
+		if(jit->code_used + M68K_JIT_MAX_BLOCK_SIZE > M68K_JIT_CODE_SIZE)
+		{
+			m68ki_jit_flush();
+			block->generation = jit->generation;
+		}
+		/* the pages may hold other blocks, which are not running now */
+		code = jit->code + jit->code_used;
+		if(!m68ki_jit_protect(code, M68K_JIT_MAX_BLOCK_SIZE, PROT_READ | PROT_WRITE))
+			return 0;
+		block->code = m68ki_jit_compile(pc);
+		if(!m68ki_jit_protect(code, M68K_JIT_MAX_BLOCK_SIZE, PROT_READ | PROT_EXEC))
+		{
+			/* the other blocks in these pages cannot run either */
+			m68ki_jit_flush();
+			block->code = NULL;
+		}
+	}
+	if(!block->code)
+		return 0;
+
+	if(jit->mode == M68K_JIT_VERIFY)
+		return m68ki_jit_verify(block->code);
+	jit->dirty = 0;
+	return block->code(&m68ki_cpu, &m68ki_remaining_cycles, &jit->dirty);
+}
+
+static void m68ki_jit_free(m68ki_jit_state* jit)
+{
+	if(jit->code && jit->code != MAP_FAILED)
+		munmap(jit->code, M68K_JIT_CODE_SIZE);
+	free(jit->code_pages);
+	free(jit->blocks);
+	free(jit->logs);
+	free(jit);
+}
+
+int m68k_set_jit(int mode)
+{
+	m68ki_jit_state* jit = m68ki_cpu.jit;
+
+	if(mode == M68K_JIT_OFF)
+	{
+		if(jit)
+			m68ki_jit_free(jit);
+		m68ki_cpu.jit = NULL;
+		return 1;
+	}
+	if(!jit)
+	{
+		if(m68ki_cpu.direct_ram_size >> M68K_JIT_PAGE_SHIFT == 0)
+			return 0;
+		jit = calloc(1, sizeof(m68ki_jit_state));
+		if(!jit)
+			return 0;
+		jit->generation = 1;
+		jit->code_page_count = m68ki_cpu.direct_ram_size >> M68K_JIT_PAGE_SHIFT;
+		jit->code_pages = calloc(jit->code_page_count, sizeof(uint));
+		jit->blocks = calloc(M68K_JIT_BLOCKS, sizeof(struct m68ki_jit_block));
+		jit->logs = calloc(2, sizeof(struct m68ki_jit_log));
+		jit->code = mmap(NULL, M68K_JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		/* fails early where memory cannot be made executable (SELinux
+		 * execmem, PaX), rather than at the first block */
+		if(!jit->code_pages || !jit->blocks || !jit->logs || jit->code == MAP_FAILED
+		   || mprotect(jit->code, M68K_JIT_CODE_SIZE, PROT_READ | PROT_EXEC))
+		{
+			m68ki_jit_free(jit);
+			return 0;
+		}
+		m68ki_cpu.jit = jit;
+	}
+	/* verify mode compiles blocks differently */
+	jit->mode = mode;
+	m68ki_jit_flush();
+	return 1;
+}
+
+#else /* __x86_64__ */
+
+void m68ki_jit_flush(void)
+{
+}
+
+void m68ki_jit_log_write(uint address, uint size, uint value)
+{
+	(void)address;
+	(void)size;
+	(void)value;
+}
+
+static int m68ki_jit_execute(void)
+{
+	return 0;
+}
+
+static void m68ki_jit_free(m68ki_jit_state* jit)
+{
+	(void)jit;
+}
+
+int m68k_set_jit(int mode)
+{
+	return mode == M68K_JIT_OFF;
+}
+
+#endif /* __x86_64__ */
+
+#else /* M68K_JIT */
+
+int m68k_set_jit(int mode)
+{
+	(void)mode;
+	return 0;
+}
+
+#endif /* M68K_JIT */
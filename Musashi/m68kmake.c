@@ -69,6 +69,8 @@ static const char g_version[] = "4.60";
 #include <ctype.h>
 #include <stdarg.h>
 
+#include "m68kconf.h"
+
 
 
 /* ======================================================================== */
@@ -236,8 +238,8 @@ void get_base_name(char* base_name, opcode_struct* op);
 void write_function_name(FILE* filep, char* base_name);
 void add_opcode_output_table_entry(opcode_struct* op, char* name);
 static int DECL_SPEC compare_nof_true_bits(const void* aptr, const void* bptr);
+void build_opcode_table(void);
 void print_opcode_output_table(FILE* filep);
-void write_table_entry(FILE* filep, opcode_struct* op);
 void set_opcode_struct(opcode_struct* src, opcode_struct* dst, int ea_mode);
 void generate_opcode_handler(FILE* filep, body_struct* body, replace_struct* replace, opcode_struct* opinfo, int ea_mode);
 void generate_opcode_ea_variants(FILE* filep, body_struct* body, replace_struct* replace, opcode_struct* op);
@@ -270,6 +272,13 @@ opcode_struct g_opcode_input_table[MAX_OPCODE_INPUT_TABLE_LENGTH];
 opcode_struct g_opcode_output_table[MAX_OPCODE_OUTPUT_TABLE_LENGTH];
 int g_opcode_output_table_length = 0;
 
+/* Every opcode resolved to an entry of the output table (-1 for illegal) */
+int g_opcode_handler[0x10000];
+unsigned char g_opcode_cycles[NUM_CPUS][0x10000];
+
+/* Index of every entry of the output table in the generated handler table */
+int g_handler_index[MAX_OPCODE_OUTPUT_TABLE_LENGTH];
+
 const ea_info_struct g_ea_info_table[13] =
 {/* fname    ea        mask  match */
 	{"",     "",       0x00, 0x00}, /* EA_MODE_NONE */
@@ -816,31 +825,139 @@ static int DECL_SPEC compare_nof_true_bits(const void* aptr, const void* bptr)
 	return a->op_match - b->op_match;
 }
 
-void print_opcode_output_table(FILE* filep)
+/* Set the handler and cycles of one opcode */
+static void set_opcode(int instr, int index)
+{
+	int k;
+
+	g_opcode_handler[instr] = index;
+	for(k=0;k<NUM_CPUS;k++)
+		g_opcode_cycles[k][instr] = g_opcode_output_table[index].cycles[k];
+}
+
+/* Resolve every opcode from the sorted output table.  Entries with more
+ * significant bits come later and override the ones before them.
+ */
+void build_opcode_table(void)
 {
+	int index = 0;
+	int length = g_opcode_output_table_length;
+	int instr;
 	int i;
-	qsort((void *)g_opcode_output_table, g_opcode_output_table_length, sizeof(g_opcode_output_table[0]), compare_nof_true_bits);
+	int j;
+	int k;
 
-	for(i=0;i<g_opcode_output_table_length;i++)
-		write_table_entry(filep, g_opcode_output_table+i);
+	for(i = 0; i < 0x10000; i++)
+	{
+		/* default to illegal */
+		g_opcode_handler[i] = -1;
+		for(k=0;k<NUM_CPUS;k++)
+			g_opcode_cycles[k][i] = 0;
+	}
+
+	for(;index < length && g_opcode_output_table[index].op_mask != 0xff00;index++)
+	{
+		opcode_struct* op = g_opcode_output_table + index;
+		for(i = 0;i < 0x10000;i++)
+			if((i & op->op_mask) == op->op_match)
+				set_opcode(i, index);
+	}
+	for(;index < length && g_opcode_output_table[index].op_mask == 0xff00;index++)
+		for(i = 0;i <= 0xff;i++)
+			set_opcode(g_opcode_output_table[index].op_match | i, index);
+	for(;index < length && g_opcode_output_table[index].op_mask == 0xf1f8;index++)
+	{
+		for(i = 0;i < 8;i++)
+		{
+			for(j = 0;j < 8;j++)
+			{
+				instr = g_opcode_output_table[index].op_match | (i << 9) | j;
+				set_opcode(instr, index);
+				/* For all shift operations with known shift distance (encoded in instruction word) */
+				if((instr & 0xf000) == 0xe000 && (!(instr & 0x20)))
+				{
+					/* On the 68000 and 68010 shift distance affect execution time.
+					 * Add the cycle cost of shifting; 2 times the shift distance
+					 * On the 68020 shift distance does not affect execution time
+					 */
+					int cycle_cost = ((((i-1)&7)+1)<<1);
+					g_opcode_cycles[0][instr] += cycle_cost;
+					g_opcode_cycles[1][instr] += cycle_cost;
+				}
+			}
+		}
+	}
+	for(;index < length && g_opcode_output_table[index].op_mask == 0xfff0;index++)
+		for(i = 0;i <= 0x0f;i++)
+			set_opcode(g_opcode_output_table[index].op_match | i, index);
+	for(;index < length && g_opcode_output_table[index].op_mask == 0xf1ff;index++)
+		for(i = 0;i <= 0x07;i++)
+			set_opcode(g_opcode_output_table[index].op_match | (i << 9), index);
+	for(;index < length && g_opcode_output_table[index].op_mask == 0xfff8;index++)
+		for(i = 0;i <= 0x07;i++)
+			set_opcode(g_opcode_output_table[index].op_match | i, index);
+	for(;index < length && g_opcode_output_table[index].op_mask == 0xffff;index++)
+		set_opcode(g_opcode_output_table[index].op_match, index);
+	if(index != length)
+		error_exit("Opcode table entry %s with mask %04x is out of order", g_opcode_output_table[index].name, g_opcode_output_table[index].op_mask);
 }
 
-/* Write an entry in the opcode handler table */
-void write_table_entry(FILE* filep, opcode_struct* op)
+/* Write the jump table and the cycle tables */
+void print_opcode_output_table(FILE* filep)
 {
 	int i;
+	int k;
+	int handlers = 0;
 
-	fprintf(filep, "\t{%-28s, 0x%04x, 0x%04x, {",
-		op->name, op->op_mask, op->op_match);
+	qsort((void *)g_opcode_output_table, g_opcode_output_table_length, sizeof(g_opcode_output_table[0]), compare_nof_true_bits);
+	build_opcode_table();
 
-	for(i=0;i<NUM_CPUS;i++)
+	/* The jump table holds indices into a table of the handlers that are
+	 * used, numbered in order of their first opcode, so that the 64K table
+	 * needs no relocations in a position independent build.  Index 0 is
+	 * m68k_op_illegal.
+	 */
+	for(i=0;i<g_opcode_output_table_length;i++)
+		g_handler_index[i] = 0;
+	fprintf(filep, "void (*const m68ki_instruction_handler_table[])(void) = /* opcode handlers by index */\n{\n");
+	fprintf(filep, "\t/* %04x */ m68k_op_illegal,\n", 0);
+	for(i=0;i<0x10000;i++)
+	{
+		k = g_opcode_handler[i];
+		if(k >= 0 && g_handler_index[k] == 0)
+		{
+			g_handler_index[k] = ++handlers;
+			fprintf(filep, "\t/* %04x */ %s,\n", handlers, g_opcode_output_table[k].name);
+		}
+	}
+	fprintf(filep, "};\n\n");
+
+	fprintf(filep, "const unsigned short m68ki_instruction_jump_table[0x10000] = /* opcode handler jump table */\n{\n");
+	for(i=0;i<0x10000;i++)
 	{
-		fprintf(filep, "%3d", op->cycles[i]);
-		if(i < NUM_CPUS-1)
-			fprintf(filep, ", ");
+		if((i & 15) == 0)
+			fprintf(filep, "\t/* %04x */", i);
+		fprintf(filep, " %d,", (g_opcode_handler[i] < 0) ? 0 : g_handler_index[g_opcode_handler[i]]);
+		if((i & 15) == 15)
+			fprintf(filep, "\n");
 	}
+	fprintf(filep, "};\n\n");
 
-	fprintf(filep, "}},\n");
+	fprintf(filep, "const unsigned char m68ki_cycles[NUM_CPU_TYPES][0x10000] = /* Cycles used by CPU type */\n{\n");
+	for(k=0;k<(M68K_68000_ONLY ? 1 : NUM_CPUS);k++)
+	{
+		fprintf(filep, "\t{\n");
+		for(i=0;i<0x10000;i++)
+		{
+			if((i & 15) == 0)
+				fprintf(filep, "\t\t/* %04x */", i);
+			fprintf(filep, " %d,", g_opcode_cycles[k][i]);
+			if((i & 15) == 15)
+				fprintf(filep, "\n");
+		}
+		fprintf(filep, "\t},\n");
+	}
+	fprintf(filep, "};\n");
 }
 
 /* Fill out an opcode struct with a specific addressing mode of the source opcode struct */
@@ -1040,6 +1157,12 @@ void process_opcode_handlers(FILE* filep)
 		if(opinfo == NULL)
 			error_exit("Unable to find matching table entry for %s", func_name);
 
+#if M68K_68000_ONLY
+		/* Leave out the handlers that the 68000 does not have */
+		if(opinfo->cpus[0] == UNSPECIFIED_CH)
+			continue;
+#endif
+
 		replace->length = 0;
 
 		/* Generate opcode variants */
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# synthesis statistics of 'narrator' speaking the fixed phonetic corpus
+#
+# the phonetic text in bench/corpus.txt is spoken once with 'narrator -S' for
+# every device file given (narrator.device in the current directory if none),
+# and the statistics of each run (see 'narrator -b') are written to stdout as
+# a JSON array, init and synthesis separately, with the time to the first
+# samples of every utterance, any options for 'narrator' go in NARRATOR_OPTIONS
+#
+#   sh bench/corpus.sh narrator.device~1.0 narrator.device~1.2 narrator.device~2.04 >corpus.json
+#
+# the instruction counts are null unless Musashi counts instructions, build
+# with -DM68K_INSTRUCTION_BUDGET=OPT_ON for them
+
+TOP="$(dirname "$0")/.."
+CORPUS="$TOP/bench/corpus.txt"
+STATS=$(mktemp) || exit 1
+
+if [ $# -eq 0 ]; then
+    set -- narrator.device
+fi
+
+SEPARATOR=""
+echo "["
+for DEVICE in "$@"; do
+    "$TOP/narrator" $NARRATOR_OPTIONS -d "$DEVICE" -b "$STATS" -S <"$CORPUS" >/dev/null 2>/dev/null || { rm -f "$STATS"; exit 1; }
+    printf "$SEPARATOR"
+    cat "$STATS"
+    SEPARATOR=",\n"
+done
+echo "]"
+rm -f "$STATS"
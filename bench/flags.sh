@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# synthesis time of 'narrator' built with different Musashi options
+#
+# every argument after the phonetic text file is a set of build flags, the
+# tree is rebuilt with each of them in turn (see build.sh), and 'narrator -S'
+# speaks the whole file 3 times, the best time is reported
+#
+#   sh bench/flags.sh lines.txt "-O2" "-O2 -DM68K_EMULATE_BUS_ERROR=OPT_ON"
+#
+# the build modes of build.sh can be given too, "" is the default build
+#
+#   sh bench/flags.sh lines.txt "" release pgo
+#
+# the tree is left built with the last set of flags, set NARRATOR_OPTIONS for
+# options such as -d narrator.device
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <phonetic_text_file> <build_flags> [build_flags...]"
+    exit 1
+fi
+LINES="$1"
+shift
+
+TOP="$(dirname "$0")/.."
+UTTERANCES=$(grep -c . "$LINES")
+
+echo "utterances $UTTERANCES"
+for FLAGS in "$@"; do
+    (cd "$TOP" && make -C Musashi clean >/dev/null && sh build.sh $FLAGS >/dev/null 2>&1) || exit 1
+    SIZE=$(stat -c %s "$TOP/narrator")
+    BEST=""
+    for RUN in 1 2 3; do
+        START=$(date +%s.%N)
+        "$TOP/narrator" $NARRATOR_OPTIONS -S <"$LINES" >/dev/null 2>/dev/null || exit 1
+        END=$(date +%s.%N)
+        BEST=$(echo "$START $END $BEST" | awk '{ t = $2-$1; if ($3 != "" && $3 < t) t = $3; printf("%.3f", t) }')
+    done
+    echo "$BEST $UTTERANCES $SIZE $FLAGS" | awk '{ printf("seconds %7.3f utterances/sec %8.2f bytes %8d flags", $1, $2/$1, $3); for (i = 4; i <= NF; i++) printf(" %s", $i); printf("\n") }'
+done
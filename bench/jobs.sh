@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# throughput of 'narrator -j' with 1, 2, 4, 8 and 16 workers
+#
+# the phonetic text is read from the file given as the first argument, one
+# utterance per line, any further arguments are passed on to 'narrator'
+#
+#   sh bench/jobs.sh lines.txt -d narrator.device
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <phonetic_text_file> [narrator options]"
+    exit 1
+fi
+LINES="$1"
+shift
+
+NARRATOR="$(dirname "$0")/../narrator"
+UTTERANCES=$(grep -c . "$LINES")
+
+echo "utterances $UTTERANCES cores $(nproc)"
+for JOBS in 1 2 4 8 16; do
+    START=$(date +%s.%N)
+    "$NARRATOR" "$@" -j $JOBS <"$LINES" >/dev/null 2>/dev/null || exit 1
+    END=$(date +%s.%N)
+    echo "$JOBS $START $END $UTTERANCES" | awk '{ printf("workers %2d seconds %7.3f utterances/sec %8.2f\n", $1, $3-$2, $4/($3-$2)) }'
+done
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# throughput of 'translator -f' converting a whole English text file
+#
+# the text is read from the file given as the first argument, any further
+# arguments are passed on to 'translator', the file is translated 3 times and
+# the best time is reported
+#
+#   sh bench/translate.sh catalog.txt -l translator.library
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <text_file> [translator options]"
+    exit 1
+fi
+TEXT="$1"
+shift
+
+TRANSLATOR="$(dirname "$0")/../translator"
+SENTENCES=$("$TRANSLATOR" "$@" -f "$TEXT" 2>/dev/null | wc -l) || exit 1
+
+BEST=""
+for RUN in 1 2 3; do
+    START=$(date +%s.%N)
+    "$TRANSLATOR" "$@" -f "$TEXT" >/dev/null 2>/dev/null || exit 1
+    END=$(date +%s.%N)
+    BEST=$(echo "$START $END $BEST" | awk '{ t = $2-$1; if ($3 != "" && $3 < t) t = $3; printf("%.3f", t) }')
+done
+echo "$BEST $SENTENCES" | awk '{ printf("sentences %d seconds %7.3f sentences/sec %8.2f\n", $2, $1, $2/$1) }'
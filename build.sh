@@ -3,10 +3,63 @@
 set -x
 set -e
 
-cd Musashi
-make
-cd ..
+# extra compiler flags can be given as arguments, for example:
+#   sh build.sh -DM68K_INSTRUCTION_HOOK=OPT_ON
+# run 'make -C Musashi clean' first when changing them
+#
+# 'release' as the first argument adds -O3 and link-time optimization, so that
+# the memory callbacks of 'narrator' and 'translator' can be inlined into
+# Musashi, 'pgo' does the same and also optimizes with the profile of
+# 'narrator -S' speaking bench/corpus.txt, which needs narrator.device (set
+# NARRATOR_OPTIONS for options such as -d narrator.device):
+#   sh build.sh release
+#   sh build.sh pgo -DM68K_68000_ONLY=OPT_ON
 
-gcc -IMusashi -o translator translator.c Musashi/*.o Musashi/softfloat/*.o
-gcc -IMusashi -o narrator narrator.c Musashi/*.o Musashi/softfloat/*.o
+build()
+{
+    cd Musashi
+    make EXTRA_CFLAGS="$*"
+    cd ..
 
+    # softfloat is not built for -DM68K_68000_ONLY=OPT_ON
+    OBJS="Musashi/m68kcpu.o Musashi/m68kdasm.o Musashi/m68kops.o"
+    if [ -f Musashi/softfloat/softfloat.o ]; then
+        OBJS="$OBJS Musashi/softfloat/softfloat.o"
+    fi
+
+    gcc -IMusashi $* -o translator translator.c translator_library.c memmap.c $OBJS -lpthread
+    gcc -IMusashi $* -o narrator narrator.c frontend.c narrator_device.c memmap.c $OBJS -lpthread
+    gcc -IMusashi $* -o speak speak.c frontend.c translator_library.c narrator_device.c memmap.c $OBJS -lpthread
+
+    # the device as a library for other programs, see narrator_device.h,
+    # link with -lnarrator -lpthread
+    gcc -IMusashi $* -c -o narrator_device.o narrator_device.c
+    gcc -IMusashi $* -c -o memmap.o memmap.c
+    rm -f libnarrator.a
+    gcc-ar rcs libnarrator.a narrator_device.o memmap.o $OBJS
+}
+
+# fat objects also carry machine code, so libnarrator.a links with or without
+# -flto, and with a linker that has no lto plugin
+RELEASE_CFLAGS="-O3 -flto=auto -ffat-lto-objects"
+
+case "$1" in
+release)
+    shift
+    make -C Musashi clean
+    build $RELEASE_CFLAGS $*
+    ;;
+pgo)
+    shift
+    rm -f *.gcda Musashi/*.gcda Musashi/softfloat/*.gcda
+    make -C Musashi clean
+    build $RELEASE_CFLAGS -fprofile-generate $*
+    ./narrator $NARRATOR_OPTIONS -S <bench/corpus.txt >/dev/null
+    make -C Musashi clean
+    build $RELEASE_CFLAGS -fprofile-use -fprofile-partial-training -Wno-missing-profile $*
+    rm -f *.gcda Musashi/*.gcda Musashi/softfloat/*.gcda
+    ;;
+*)
+    build $*
+    ;;
+esac
@@ -0,0 +1,109 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frontend.h"
+
+void write_all(int fd, unsigned char *buf, unsigned int len)
+{
+    while (len > 0) {
+        int result = write(fd, buf, len);
+        if (result <= 0) {
+            fprintf(stderr, "unable to write output\n");
+            exit(1);
+        }
+        buf += result;
+        len -= result;
+    }
+}
+
+struct narrator *new_narrator()
+{
+    struct narrator *n = narrator_new();
+    if (!n) {
+        fprintf(stderr, "unable to allocate narrator\n");
+        exit(1);
+    }
+    return n;
+}
+
+// the device does not exit by itself, it leaves the reason in n->error
+void check_narrator(struct narrator *n)
+{
+    if (n->error[0]) {
+        fprintf(stderr, "%s\n", n->error);
+        exit(1);
+    }
+}
+
+int parse_speech_option(struct narrator_params *params, int argc, char **argv, int *i)
+{
+    char *name;
+    int *field;
+    if (!strcmp(argv[*i], "-f")) {
+        name = "sampling_frequency";
+        field = &params->sampfreq;
+    } else if (!strcmp(argv[*i], "-m")) {
+        name = "mode";
+        field = &params->mode;
+    } else if (!strcmp(argv[*i], "-p")) {
+        name = "pitch";
+        field = &params->pitch;
+    } else if (!strcmp(argv[*i], "-r")) {
+        name = "rate";
+        field = &params->rate;
+    } else if (!strcmp(argv[*i], "-s")) {
+        name = "sex";
+        field = &params->sex;
+    } else {
+        return 0;
+    }
+    if (*i+1 >= argc) {
+        fprintf(stderr, "error, expecting %s for %s\n", name, argv[*i]);
+        exit(1);
+    }
+    long val = strtol(argv[*i+1], 0, 10);
+    // out of range for every parameter if it does not fit
+    *field = ((val < INT_MIN) || (val > INT_MAX)) ? -1 : val;
+    (*i)++;
+    return 1;
+}
+
+// the ranges are checked once all the options have been read
+void set_speech_params(struct narrator *n, struct narrator_params *params)
+{
+    char error[256];
+    if (!narrator_check_params(params, error, sizeof(error))) {
+        fprintf(stderr, "error, %s\n", error);
+        exit(1);
+    }
+    narrator_set_params(n, params);
+}
@@ -0,0 +1,45 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include "narrator_device.h"
+
+/*
+ what the command line tools 'narrator' and 'speak' have in common, unlike the
+ library API in narrator_device.h these print the reason and exit
+ */
+
+void write_all(int fd, unsigned char *buf, unsigned int len);
+struct narrator *new_narrator();
+void check_narrator(struct narrator *n);
+
+// -f, -m, -p, -r and -s, returns 0 if argv[*i] is not one of them
+int parse_speech_option(struct narrator_params *params, int argc, char **argv, int *i);
+void set_speech_params(struct narrator *n, struct narrator_params *params);
+
+#endif /* FRONTEND_H */
@@ -0,0 +1,243 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "m68k.h"
+#include "memmap.h"
+
+void memmap_init(struct memmap *map)
+{
+    memset(map, 0, sizeof(struct memmap));
+}
+
+// addr and size are multiples of MEMMAP_PAGE_SIZE, host has at least size bytes
+void memmap_map_ram(struct memmap *map, unsigned int addr, unsigned int size, unsigned char *host)
+{
+    for (unsigned int offset=0; offset<size; offset+=MEMMAP_PAGE_SIZE) {
+        struct memmap_page *page = &map->pages[(addr+offset) >> MEMMAP_PAGE_SHIFT];
+        page->host = host+offset;
+        page->read = 0;
+        page->write = 0;
+    }
+}
+
+void memmap_map_handlers(struct memmap *map, unsigned int addr, unsigned int size, memmap_read_func read, memmap_write_func write)
+{
+    for (unsigned int offset=0; offset<size; offset+=MEMMAP_PAGE_SIZE) {
+        struct memmap_page *page = &map->pages[(addr+offset) >> MEMMAP_PAGE_SHIFT];
+        page->host = 0;
+        page->read = read;
+        page->write = write;
+    }
+}
+
+void memmap_set_current(struct memmap *map)
+{
+    m68k_set_user_data(map);
+}
+
+struct memmap *memmap_get_current()
+{
+    return m68k_get_user_data();
+}
+
+unsigned int memmap_read_slow(struct memmap *map, unsigned int addr, int size)
+{
+    unsigned int index = addr >> MEMMAP_PAGE_SHIFT;
+    if ((index < MEMMAP_NUMBER_OF_PAGES) && map->pages[index].host) {
+        // crosses into the next page, one byte at a time
+        unsigned int val = 0;
+        for (int i=0; i<size/8; i++) {
+            val <<= 8;
+            val |= memmap_read_8(map, addr+i);
+        }
+        return val;
+    }
+    if ((index < MEMMAP_NUMBER_OF_PAGES) && map->pages[index].read) {
+        return map->pages[index].read(addr, size);
+    }
+    if (map->fault) {
+        map->fault(map, addr, size, 0);
+    } else {
+        fprintf(stderr, "m68k_read_memory_%d %x OUT OF BOUNDS\n", size, addr);
+    }
+    return 0;
+}
+
+void memmap_write_slow(struct memmap *map, unsigned int addr, unsigned int val, int size)
+{
+    unsigned int index = addr >> MEMMAP_PAGE_SHIFT;
+    if ((index < MEMMAP_NUMBER_OF_PAGES) && map->pages[index].host) {
+        for (int i=size/8-1; i>=0; i--) {
+            memmap_write_8(map, addr+i, val);
+            val >>= 8;
+        }
+        return;
+    }
+    if ((index < MEMMAP_NUMBER_OF_PAGES) && map->pages[index].write) {
+        map->pages[index].write(addr, val, size);
+        return;
+    }
+    if (map->fault) {
+        map->fault(map, addr, size, 1);
+    } else {
+        fprintf(stderr, "m68k_write_memory_%d %x OUT OF BOUNDS\n", size, addr);
+    }
+}
+
+unsigned int m68k_read_memory_8(unsigned int addr)
+{
+    struct memmap *map = m68k_get_user_data();
+    return memmap_read_8(map, addr);
+}
+
+unsigned int m68k_read_memory_16(unsigned int addr)
+{
+    struct memmap *map = m68k_get_user_data();
+    return memmap_read_16(map, addr);
+}
+
+unsigned int m68k_read_memory_32(unsigned int addr)
+{
+    struct memmap *map = m68k_get_user_data();
+    return memmap_read_32(map, addr);
+}
+
+void m68k_write_memory_8(unsigned int addr, unsigned int val)
+{
+    struct memmap *map = m68k_get_user_data();
+    if (map->trace_writes) {
+        fprintf(stderr, "m68k_write_memory_8 addr %x val %x\n", addr, val);
+    }
+    memmap_write_8(map, addr, val);
+}
+
+void m68k_write_memory_16(unsigned int addr, unsigned int val)
+{
+    struct memmap *map = m68k_get_user_data();
+    if (map->trace_writes) {
+        fprintf(stderr, "m68k_write_memory_16 addr %x val %x\n", addr, val);
+    }
+    memmap_write_16(map, addr, val);
+}
+
+void m68k_write_memory_32(unsigned int addr, unsigned int val)
+{
+    struct memmap *map = m68k_get_user_data();
+    if (map->trace_writes) {
+        fprintf(stderr, "m68k_write_memory_32 addr %x val %x\n", addr, val);
+    }
+    memmap_write_32(map, addr, val);
+}
+
+void m68k_write_memory_32_no_log(unsigned int addr, unsigned int val)
+{
+    struct memmap *map = m68k_get_user_data();
+    memmap_write_32(map, addr, val);
+}
+
+unsigned int m68k_read_disassembler_8(unsigned int addr)
+{
+    struct memmap *map = m68k_get_user_data();
+    return memmap_read_8(map, addr);
+}
+
+unsigned int m68k_read_disassembler_16(unsigned int addr)
+{
+    struct memmap *map = m68k_get_user_data();
+    return memmap_read_16(map, addr);
+}
+
+unsigned int m68k_read_disassembler_32(unsigned int addr)
+{
+    struct memmap *map = m68k_get_user_data();
+    return memmap_read_32(map, addr);
+}
+
+static void make_hex(char *buf, unsigned int pc, unsigned int len)
+{
+    char *p = buf;
+    for (int i=0; i<len; i+=2) {
+        if (i > 0) {
+            *p++ = ' ';
+        }
+        sprintf(p, "%04x", m68k_read_memory_16(pc));
+        pc += 2;
+        p += 4;
+    }
+}
+
+void memmap_trace_instruction(unsigned int pc)
+{
+    char buf[256];
+    char buf2[256];
+
+    unsigned int sp = m68k_get_reg(0, M68K_REG_SP);
+
+    unsigned int instr_size = m68k_disassemble(buf, pc, M68K_CPU_TYPE_68000);
+    make_hex(buf2, pc, instr_size);
+    unsigned int a0 = m68k_get_reg(0, M68K_REG_A0);
+    unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+    unsigned int a2 = m68k_get_reg(0, M68K_REG_A2);
+    unsigned int a3 = m68k_get_reg(0, M68K_REG_A3);
+    unsigned int a4 = m68k_get_reg(0, M68K_REG_A4);
+    unsigned int a5 = m68k_get_reg(0, M68K_REG_A5);
+    unsigned int a6 = m68k_get_reg(0, M68K_REG_A6);
+    fprintf(stderr, "Execute %03x: %-20s: %s (SP=%x A0=%x A1=%x A2=%x A3=%x A4=%x A5=%x A6=%x)\n", pc, buf2, buf, sp, a0, a1, a2, a3, a4, a5, a6);
+}
+
+#define RAM_REPORT_PAGESIZE 0x10000
+
+// ram is page aligned, as from mmap()
+void memmap_print_ram_usage(unsigned char *ram, unsigned int size)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    unsigned int number_of_pages = size/pagesize;
+    unsigned char *vec = malloc(number_of_pages);
+    if (!vec || mincore(ram, size, vec)) {
+        free(vec);
+        return;
+    }
+    unsigned int resident = 0;
+    unsigned int touched = 0;
+    int last = -1;
+    for (unsigned int i=0; i<number_of_pages; i++) {
+        if (vec[i] & 1) {
+            resident++;
+            int region = (i*pagesize)/RAM_REPORT_PAGESIZE;
+            if (region != last) {
+                touched++;
+                last = region;
+            }
+        }
+    }
+    free(vec);
+    fprintf(stderr, "ram touched %u of %u 64 KB pages, resident %lu KB\n", touched, size/RAM_REPORT_PAGESIZE, resident*pagesize/1024);
+}
@@ -0,0 +1,178 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef MEMMAP_H
+#define MEMMAP_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ the 24-bit address space of the 68000 as a table of 64 KB pages
+
+ a page either points at host memory, which is read and written directly,
+ or has handlers that are called for every access, a page that has not
+ been mapped reports the access as out of bounds
+
+ the m68k_read_memory_* and m68k_write_memory_* callbacks for Musashi go
+ through the map of the current cpu context, see memmap_set_current()
+ */
+
+// the trace levels of the narrator and translator instances
+#define TRACE_OFF 0 //errors only
+#define TRACE_TRAPS 1 //loader, exec.library calls and statistics
+#define TRACE_FULL 2 //every instruction and memory write
+
+#define MEMMAP_PAGE_SHIFT 16
+#define MEMMAP_PAGE_SIZE (1<<MEMMAP_PAGE_SHIFT)
+#define MEMMAP_NUMBER_OF_PAGES 256
+
+// size is 8, 16 or 32
+typedef unsigned int (*memmap_read_func)(unsigned int addr, int size);
+typedef void (*memmap_write_func)(unsigned int addr, unsigned int val, int size);
+
+struct memmap_page {
+    unsigned char *host; //start of the page in host memory, or 0 to use the handlers
+    memmap_read_func read;
+    memmap_write_func write;
+};
+
+struct memmap;
+
+// an access that no page handles, write is 1 for writes
+typedef void (*memmap_fault_func)(struct memmap *map, unsigned int addr, int size, int write);
+
+struct memmap {
+    struct memmap_page pages[MEMMAP_NUMBER_OF_PAGES];
+    int trace_writes; //log every write from the emulated code to stderr
+    memmap_fault_func fault; //0 to log out of bounds accesses to stderr
+    void *owner; //the instance the map belongs to, for its callbacks
+};
+
+void memmap_init(struct memmap *map);
+void memmap_map_ram(struct memmap *map, unsigned int addr, unsigned int size, unsigned char *host);
+void memmap_map_handlers(struct memmap *map, unsigned int addr, unsigned int size, memmap_read_func read, memmap_write_func write);
+// the map is kept in the current cpu context, after m68k_init()
+void memmap_set_current(struct memmap *map);
+struct memmap *memmap_get_current();
+
+// for TRACE_FULL, the instruction at pc with its words and the address
+// registers, from the instruction hook of the current cpu
+void memmap_trace_instruction(unsigned int pc);
+// how much of the host memory of an instance has been touched, to stderr
+void memmap_print_ram_usage(unsigned char *ram, unsigned int size);
+
+// the loader writes through this one so that the trace is not flooded
+void m68k_write_memory_32_no_log(unsigned int addr, unsigned int val);
+
+// accesses that are not inside a single page of host memory
+unsigned int memmap_read_slow(struct memmap *map, unsigned int addr, int size);
+void memmap_write_slow(struct memmap *map, unsigned int addr, unsigned int val, int size);
+
+// returns the host address if the access is inside a single page of host memory
+static inline unsigned char *memmap_host(struct memmap *map, unsigned int addr, int bytes)
+{
+    unsigned int index = addr >> MEMMAP_PAGE_SHIFT;
+    unsigned int offset = addr & (MEMMAP_PAGE_SIZE-1);
+    if ((index >= MEMMAP_NUMBER_OF_PAGES) || (offset > MEMMAP_PAGE_SIZE-bytes)) {
+        return 0;
+    }
+    unsigned char *host = map->pages[index].host;
+    return (host) ? host+offset : 0;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define memmap_be16(x) __builtin_bswap16(x)
+#define memmap_be32(x) __builtin_bswap32(x)
+#else
+#define memmap_be16(x) (x)
+#define memmap_be32(x) (x)
+#endif
+
+static inline unsigned int memmap_read_8(struct memmap *map, unsigned int addr)
+{
+    unsigned char *p = memmap_host(map, addr, 1);
+    if (!p) {
+        return memmap_read_slow(map, addr, 8);
+    }
+    return *p;
+}
+
+static inline unsigned int memmap_read_16(struct memmap *map, unsigned int addr)
+{
+    unsigned char *p = memmap_host(map, addr, 2);
+    if (!p) {
+        return memmap_read_slow(map, addr, 16);
+    }
+    uint16_t val;
+    memcpy(&val, p, 2);
+    return memmap_be16(val);
+}
+
+static inline unsigned int memmap_read_32(struct memmap *map, unsigned int addr)
+{
+    unsigned char *p = memmap_host(map, addr, 4);
+    if (!p) {
+        return memmap_read_slow(map, addr, 32);
+    }
+    uint32_t val;
+    memcpy(&val, p, 4);
+    return memmap_be32(val);
+}
+
+static inline void memmap_write_8(struct memmap *map, unsigned int addr, unsigned int val)
+{
+    unsigned char *p = memmap_host(map, addr, 1);
+    if (!p) {
+        memmap_write_slow(map, addr, val, 8);
+        return;
+    }
+    *p = val;
+}
+
+static inline void memmap_write_16(struct memmap *map, unsigned int addr, unsigned int val)
+{
+    unsigned char *p = memmap_host(map, addr, 2);
+    if (!p) {
+        memmap_write_slow(map, addr, val, 16);
+        return;
+    }
+    uint16_t be = memmap_be16((uint16_t) val);
+    memcpy(p, &be, 2);
+}
+
+static inline void memmap_write_32(struct memmap *map, unsigned int addr, unsigned int val)
+{
+    unsigned char *p = memmap_host(map, addr, 4);
+    if (!p) {
+        memmap_write_slow(map, addr, val, 32);
+        return;
+    }
+    uint32_t be = memmap_be32((uint32_t) val);
+    memcpy(p, &be, 4);
+}
+
+#endif /* MEMMAP_H */
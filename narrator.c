@@ -28,818 +28,929 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "m68k.h"
+#include "narrator_device.h"
+#include "frontend.h"
 
-void m68k_write_memory_32_no_log(unsigned int addr, unsigned int val);
-
-static int _pitch_parameter = 110; //pitch
-static int _rate_parameter = 150; //speaking rate (wpm)
-static int _volume_parameter = 64; //volume
-static int _sampfreq_parameter = 22200; //sampling frequency (Hz)
-static int _sex_parameter = 0; //sex 0=male 1=female
-static int _mode_parameter = 0; //mode 0=naturalf0 1=roboticf0 2=manualf0
-
-#define INPUT_BUFSIZE 0x1000
-static char *_inputptr = 0;
-static char _inputbuf[INPUT_BUFSIZE];
-
-static unsigned char *_library_path = "narrator.device";
-
-#define LIBRARY_BUFSIZE 100000
-#define LIBRARY_MAX_HUNKS 8
-static unsigned char _library_buf[LIBRARY_BUFSIZE];
-static int _library_size = 0;
-static int _library_pos = 0;
-
-static int _library_number_of_hunks = 0;
-static unsigned int _library_hunk_base[LIBRARY_MAX_HUNKS];
-
-#define MAX_RAM (16*1024*1024)
-static unsigned char _ram[MAX_RAM];
-
-static unsigned int _inputbase = 0x28000;
-static unsigned int _execbase = 0x20000;
-static unsigned int _allocmem = 0x100000;
-static unsigned int _narrator_rb = 0x22000;
-static unsigned int _msgport = 0x22800;
-static unsigned int _audiomsgport = 0x22c00;
-static unsigned int _librarybase = 0x23000;
-static unsigned int _audiochanbase = 0x24000;
-static unsigned int _taskbase = 0x25000;
-static int _allocsignal = 31;
-static unsigned int _mainbase = 0x26000;
-static unsigned int _stackpointer = 0x1f000;
-static unsigned int _libraryname = 0x27000;
-static unsigned int _addtask = 0;
-static unsigned int _makelibrary = 0;
-
-void load_library()
-{
-    fprintf(stderr, "opening '%s'\n", _library_path);
-    FILE *fp = fopen(_library_path, "rb");
-    if (!fp) {
-        fprintf(stderr, "unable to open '%s'\n", _library_path);
-        exit(1);
+static int _trace_level = TRACE_OFF;
+#define trace(level, ...) do { if (_trace_level >= (level)) { fprintf(stderr, __VA_ARGS__); } } while (0)
+
+#define INPUT_BUFSIZE NARRATOR_INPUT_BUFSIZE
+static int _server_mode = 0;
+
+// M68K_JIT_OFF, M68K_JIT_ON or M68K_JIT_VERIFY, see m68k_set_jit()
+static int _engine = M68K_JIT_OFF;
+static struct narrator_params _params; //-f -m -p -r -s, for every instance
+static int _record_delimiter = '\n'; //'\n' or 0 for NUL-delimited records
+static int _framed_output = 0;
+static char *_output_pattern = 0; //-o, one file per utterance
+
+static char *_library_path = "narrator.device";
+static char *_snapshot_path = 0;
+
+static struct timespec _start_time;
+
+// read the next non-empty record from stdin, returns 0 at end of input
+// records are lines, or NUL-delimited with -0, of any length, records that do
+// not fit in the input buffer of the device are split, see split_jobs
+// the buffer is reused by the next call
+char *read_record()
+{
+    static char *buf = 0;
+    static size_t size = 0;
+    for(;;) {
+        ssize_t len = getdelim(&buf, &size, _record_delimiter, stdin);
+        if (len < 0) {
+            return 0;
+        }
+        while ((len > 0) && ((buf[len-1] == _record_delimiter) || (buf[len-1] == '\n') || (buf[len-1] == '\r'))) {
+            len--;
+        }
+        buf[len] = 0;
+        if (len > 0) {
+            return buf;
+        }
     }
-    int result = fread(_library_buf, 1, LIBRARY_BUFSIZE, fp);
-    fprintf(stderr, "fread %d (0x%x)\n", result, result);
-    _library_size = result;
-    _library_pos = 0;
-    fclose(fp);
 }
 
-unsigned int library_read_32()
+/*
+ with -j, all of stdin is read up front into a list of jobs, the workers
+ take the next job when their device asks for a message, and the main
+ thread writes the samples in input order as the jobs are finished
+ */
+
+#define MAX_WORKERS 256
+
+struct job {
+    char *text;
+    unsigned int record; //number of the utterance the job is part of
+    int split; //1 if the utterance was split into more than one job
+    unsigned char *samples;
+    unsigned int len;
+    int done;
+};
+
+static int _number_of_workers = 0;
+static struct narrator *_instances[MAX_WORKERS];
+static int _number_of_instances = 0;
+static struct job *_jobs = 0;
+static int _number_of_jobs = 0;
+static int _next_job = 0;
+static unsigned int _number_of_records = 0;
+static pthread_mutex_t _job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _job_done = PTHREAD_COND_INITIALIZER;
+
+void add_job(char *text, int len)
 {
-    if (_library_pos >= _library_size-3) {
-        fprintf(stderr, "library_read_32 past end of file %x\n", _library_pos);
+    static int size = 0;
+    if (_number_of_jobs == size) {
+        size = (size) ? size*2 : 1024;
+        _jobs = realloc(_jobs, size*sizeof(struct job));
+        if (!_jobs) {
+            fprintf(stderr, "unable to allocate jobs\n");
+            exit(1);
+        }
+    }
+    memset(&_jobs[_number_of_jobs], 0, sizeof(struct job));
+    _jobs[_number_of_jobs].record = _number_of_records;
+    _jobs[_number_of_jobs].text = strndup(text, len);
+    if (!_jobs[_number_of_jobs].text) {
+        fprintf(stderr, "unable to allocate jobs\n");
         exit(1);
     }
-    uint8_t *p = (uint8_t *) &_library_buf[_library_pos];
-    _library_pos += 4;
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p;
-    return val;
+    _number_of_jobs++;
 }
 
-void process_hunks()
-{
-    unsigned int number_of_hunks = 0;
-    unsigned int memory_pos = 0;
-    unsigned int hunk_index = 0;
-    unsigned int hunk_end = 0;
+/*
+ one utterance of phonetic text that is given with -j, or any utterance that
+ is too long for the input buffer of the device, is split into sentences,
+ which are spoken as jobs and put back together in order
+
+ the device makes a pause between the sentences of an utterance that is not
+ there at the end of a sentence that is spoken on its own, unless it is given
+ with -g, the first worker measures it before its first job, by speaking a
+ sentence on its own and then twice in a row
+ */
+
+#define GAP_SENTENCE "AH."
 
-    unsigned int reloc32_pos = 0;
-    unsigned int reloc32_hunk_index = 0;
+static int _split_text = 0; //the utterance from the command line
+static int _gap_needed = 0; //an utterance has been split into more than one job
+static int _gap_ms = -1; //-g
+static int _gap = 0; //samples, negative to drop that many from the end of a sentence
+static int _gap_known = 0;
 
+// at . or ? and when a sentence does not fit in the input buffer, at the
+// last comma that does, or else the last space
+void split_jobs(char *text)
+{
+    int first = _number_of_jobs;
+    char *p = text;
     for(;;) {
-        unsigned int hunk_id = library_read_32();
-        if (hunk_id == 0x3f3) {
-            fprintf(stderr, "found HUNK_HEADER 0x3f3\n");
-            unsigned int zero = library_read_32();
-            if (zero != 0) {
-                fprintf(stderr, "expecting 0\n");
-                exit(1);
-            }
-            number_of_hunks = library_read_32();
-            fprintf(stderr, "number_of_hunks %d\n", number_of_hunks);
-            unsigned int first_hunk = library_read_32();
-            fprintf(stderr, "first_hunk %d\n", first_hunk);
-            unsigned int last_hunk = library_read_32();
-            fprintf(stderr, "last_hunk %d\n", last_hunk);
-            for (int i=first_hunk; i<=last_hunk; i++) {
-                unsigned int hunk_size = library_read_32();
-                fprintf(stderr, "hunk %d size 0x%x\n", i, hunk_size);
-            }
-        } else if (hunk_id == 0x3e9) {
-            fprintf(stderr, "found HUNK_CODE 0x3e9\n");
-            unsigned int number_of_longwords = library_read_32();
-            fprintf(stderr, "number_of_longwords 0x%x\n", number_of_longwords);
-            if (hunk_index >= number_of_hunks) {
-                fprintf(stderr, "unexpected hunk\n");
-                exit(1);
-            }
-            _library_hunk_base[hunk_index] = memory_pos;
-            hunk_index++;
-            for (int i=0; i<number_of_longwords; i++) {
-                unsigned int val = library_read_32();
-                m68k_write_memory_32_no_log(memory_pos, val);
-                memory_pos += 4;
+        while (*p == ' ') {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        int len = 0;
+        while (p[len] && !(strchr(".?", p[len]) && ((p[len+1] == ' ') || !p[len+1]))) {
+            len++;
+        }
+        if (p[len]) {
+            len++;
+        }
+        if (len > INPUT_BUFSIZE-1) {
+            int max = INPUT_BUFSIZE-1;
+            len = max;
+            while ((len > 0) && (p[len-1] != ',')) {
+                len--;
             }
-        } else if (hunk_id == 0x3ec) {
-            fprintf(stderr, "found HUNK_RELOC32 0x3ec\n");
-            reloc32_pos = _library_pos;
-            for(;;) {
-                unsigned int number_of_offsets = library_read_32();
-                fprintf(stderr, "number_of_offsets %d\n", number_of_offsets);
-                if (!number_of_offsets) {
-                    break;
-                }
-                unsigned int hunk_number = library_read_32();
-                fprintf(stderr, "hunk_number %d\n", hunk_number);
-                for (int i=0; i<number_of_offsets; i++) {
-                    unsigned int offset = library_read_32();
-//                    fprintf(stderr, "offset %d 0x%x\n", i, offset);
+            if (len == 0) {
+                len = max;
+                while ((len > 0) && (p[len-1] != ' ')) {
+                    len--;
                 }
             }
-        } else if (hunk_id == 0x3f2) {
-            fprintf(stderr, "found HUNK_END 0x3f2\n");
-            hunk_end++;
-            if (hunk_end == number_of_hunks) {
-                fprintf(stderr, "end of hunks\n");
-                break;
-            }
-        } else if (hunk_id == 0x3ea) {
-            fprintf(stderr, "found HUNK_DATA 0x3ea\n");
-            unsigned int number_of_longwords = library_read_32();
-            fprintf(stderr, "number_of_longwords 0x%x\n", number_of_longwords);
-            if (hunk_index >= number_of_hunks) {
-                fprintf(stderr, "unexpected hunk\n");
-                exit(1);
-            }
-            _library_hunk_base[hunk_index] = memory_pos;
-            hunk_index++;
-            for (int i=0; i<number_of_longwords; i++) {
-                unsigned int val = library_read_32();
-                m68k_write_memory_32_no_log(memory_pos, val);
-                memory_pos += 4;
-            }
-        } else if (hunk_id == 0x3eb) {
-            fprintf(stderr, "found HUNK_BSS 0x3eb\n");
-            unsigned int number_of_longwords = library_read_32();
-            fprintf(stderr, "number_of_longwords 0x%x\n", number_of_longwords);
-            if (hunk_index >= number_of_hunks) {
-                fprintf(stderr, "unexpected hunk\n");
-                exit(1);
+            if (len == 0) {
+                len = max;
             }
-            _library_hunk_base[hunk_index] = memory_pos;
-            hunk_index++;
-            memory_pos += 4*number_of_longwords;
-        } else {
-            fprintf(stderr, "unhandled hunk type %x\n", hunk_id);
-            exit(1);
         }
+        add_job(p, len);
+        p += len;
     }
-
-    if (reloc32_pos) {
-        _library_pos = reloc32_pos;
-        for(;;) {
-            unsigned int number_of_offsets = library_read_32();
-            fprintf(stderr, "number_of_offsets %d\n", number_of_offsets);
-            if (!number_of_offsets) {
-                break;
-            }
-            unsigned int hunk_number = library_read_32();
-            fprintf(stderr, "hunk_number %d\n", hunk_number);
-            if (hunk_number >= hunk_index) {
-                fprintf(stderr, "hunk_number too high\n");
-                exit(1);
-            }
-            for (int i=0; i<number_of_offsets; i++) {
-                unsigned int offset = library_read_32();
-//                fprintf(stderr, "reloc32 offset %d 0x%x\n", i, offset);
-                unsigned int val = m68k_read_memory_32(offset);
-                val += _library_hunk_base[hunk_number];
-                m68k_write_memory_32_no_log(offset, val);
-            }
+    if (_number_of_jobs - first > 1) {
+        for (int i=first; i<_number_of_jobs; i++) {
+            _jobs[i].split = 1;
         }
+        _gap_needed = 1;
     }
+    _number_of_records++;
 }
 
-void process_library_with_romtag()
+void read_jobs()
 {
-    unsigned int romtagbase = 4;
-    fprintf(stderr, "rt_MatchWord 0x4afc\n");
-    fprintf(stderr, "rt_MatchTag 0x%x\n", m68k_read_memory_32(romtagbase+2));
-    fprintf(stderr, "rt_EndSkip 0x%x\n", m68k_read_memory_32(romtagbase+6));
-    unsigned int rt_Flags = m68k_read_memory_8(romtagbase+10);
-    fprintf(stderr, "rt_Flags 0x%x\n", rt_Flags);
-    unsigned int rtf_AutoInit = 0;
-    if (rt_Flags & (1<<7)) {
-        rtf_AutoInit = 1;
-        fprintf(stderr, "rt_Flags RTF_AUTOINIT\n");
-    }
-    if (rt_Flags & (1<<2)) {
-        fprintf(stderr, "rt_Flags RTF_AFTERDOS\n");
-    }
-    if (rt_Flags & (1<<1)) {
-        fprintf(stderr, "rt_Flags RTF_SINGLETASK\n");
-    }
-    if (rt_Flags & (1<<0)) {
-        fprintf(stderr, "rt_Flags RTF_COLDSTART\n");
+    char *record;
+    while ((record = read_record())) {
+        int len = strlen(record);
+        if (len < INPUT_BUFSIZE) {
+            add_job(record, len);
+            _number_of_records++;
+        } else {
+            split_jobs(record);
+        }
     }
-    fprintf(stderr, "rt_Version 0x%x\n", m68k_read_memory_8(romtagbase+11));
-    fprintf(stderr, "rt_Type 0x%x\n", m68k_read_memory_8(romtagbase+12));
-    fprintf(stderr, "rt_Pri 0x%x\n", m68k_read_memory_8(romtagbase+13));
-    unsigned int rt_Name = m68k_read_memory_32(romtagbase+14);
-    fprintf(stderr, "rt_Name 0x%x '%s'\n", rt_Name, _ram+rt_Name);
-    unsigned int rt_IdString = m68k_read_memory_32(romtagbase+18);
-    fprintf(stderr, "rt_IdString 0x%x '%s'\n", rt_IdString, _ram+rt_IdString);
-    unsigned int rt_Init = m68k_read_memory_32(romtagbase+22);
-    fprintf(stderr, "rt_Init 0x%x\n", rt_Init);
-
-
-
-    m68k_write_memory_16(_mainbase, 0x4eb9); //jsr
-    m68k_write_memory_32(_mainbase+2, rt_Init);
-
-    m68k_write_memory_16(_mainbase+6, 0x7000); //moveq #$0, D0
-    m68k_write_memory_16(_mainbase+8, 0x2c7c); //movea.l xxx, A6
-    m68k_write_memory_32(_mainbase+10, _librarybase);
-    m68k_write_memory_16(_mainbase+14, 0x227c); //movea.l xxx, A1
-    m68k_write_memory_32(_mainbase+16, _narrator_rb);
-
-    m68k_write_memory_16(_mainbase+20, 0x4eb9); //jsr
-    _makelibrary = _mainbase+22;
-    m68k_write_memory_32(_makelibrary, 0); //Open function will be filled in by MakeLibrary
-
-    m68k_write_memory_16(_mainbase+26, 0x23fc); //move.l #$xxxxxxxx, $xxxxxxxx
-    m68k_write_memory_32(_mainbase+28, _librarybase);
-    m68k_write_memory_32(_mainbase+32, _stackpointer);
+}
 
-    m68k_write_memory_16(_mainbase+36, 0x4eb9); //jsr
-    _addtask = _mainbase+38;
-    m68k_write_memory_32(_addtask, 0); //address will be filled in by AddTask
+// on the first worker, before it takes any jobs
+void measure_gap(struct narrator *n)
+{
+    int (*get_input)(struct narrator *n) = n->get_input;
+    void (*put_samples)(struct narrator *n, unsigned char *buf, unsigned int len) = n->put_samples;
+    void (*reply)(struct narrator *n) = n->reply;
+    n->get_input = 0;
+    n->put_samples = 0;
+    n->reply = 0;
+    unsigned long long start = n->sample_count;
+    narrator_speak(n, GAP_SENTENCE);
+    unsigned long long once = n->sample_count - start;
+    narrator_speak(n, GAP_SENTENCE " " GAP_SENTENCE);
+    unsigned long long twice = n->sample_count - start - once;
+    n->utterances -= 2;
+    n->get_input = get_input;
+    n->put_samples = put_samples;
+    n->reply = reply;
+
+    pthread_mutex_lock(&_job_mutex);
+    _gap = (long long)twice - 2*once;
+    _gap_known = 1;
+    pthread_cond_broadcast(&_job_done);
+    pthread_mutex_unlock(&_job_mutex);
+    trace(TRACE_TRAPS, "pause between sentences %d samples\n", _gap);
+}
 
-    m68k_write_memory_32(_mainbase+42, 0x4e722700); //stop $2700
+void setup_instance(struct narrator *n);
 
-    m68k_write_memory_8(_narrator_rb+8, 5); // ln_Type NT_MESSAGE
-    m68k_write_memory_32(_narrator_rb+14, _msgport);
-    m68k_write_memory_16(_narrator_rb+18, 70); // size of narrator_rb (old version)
-    m68k_write_memory_32(_narrator_rb+20, _librarybase);
+void *gap_thread(void *arg)
+{
+    struct narrator *n = new_narrator();
+    narrator_set_params(n, &_params);
+    setup_instance(n);
+    narrator_init(n);
+    check_narrator(n);
+    measure_gap(n);
+    narrator_close(n);
+    return 0;
+}
 
-    m68k_set_reg(M68K_REG_SP, _stackpointer);
+// server mode without -j, the instance is in the middle of m68k_execute() on
+// this thread, so the pause is measured with another one on a thread of its own
+void measure_gap_on_thread()
+{
+    pthread_t thread;
+    if (pthread_create(&thread, 0, gap_thread, 0)) {
+        fprintf(stderr, "unable to create thread\n");
+        exit(1);
+    }
+    pthread_join(thread, 0);
+}
 
+int take_job(struct narrator *n)
+{
+    pthread_mutex_lock(&_job_mutex);
+    int index = _next_job;
+    if (index < _number_of_jobs) {
+        _next_job++;
+    }
+    pthread_mutex_unlock(&_job_mutex);
+    if (index >= _number_of_jobs) {
+        return 0;
+    }
+    strcpy(n->inputbuf, _jobs[index].text);
+    n->utterance_count = index;
+    return 1;
+}
 
-    m68k_set_reg(M68K_REG_A1, rt_Name);
-    m68k_set_reg(M68K_REG_A2, _librarybase);
-    m68k_set_reg(M68K_REG_D0, 0);
-    m68k_set_reg(M68K_REG_A6, _execbase);
-    m68k_set_reg(M68K_REG_PC, _mainbase);
+// server mode, returns 0 at end of input
+int read_next_input(struct narrator *n)
+{
+    if (_number_of_workers) {
+        if (!take_job(n)) {
+            return 0;
+        }
+    } else if (_next_job < _number_of_jobs) {
+        // the next sentence of a record that has been split
+        take_job(n);
+    } else {
+        char *record = read_record();
+        if (!record) {
+            return 0;
+        }
+        if (strlen(record) < INPUT_BUFSIZE) {
+            strcpy(n->inputbuf, record);
+            n->utterance_count = _number_of_records++;
+        } else {
+            split_jobs(record);
+            if (_gap_needed && !_gap_known) {
+                measure_gap_on_thread();
+            }
+            take_job(n);
+        }
+    }
+    n->inputptr = n->inputbuf;
+    return 1;
 }
 
-void process_library()
+// samples from CMD_WRITE, written straight to stdout unless they have to be
+// kept until the end of the utterance
+void write_samples(struct narrator *n, unsigned char *buf, unsigned int len)
 {
-    if ((_ram[4] == 0x4a) && (_ram[5] == 0xfc)) {
-        fprintf(stderr, "ROMTag found\n");
-        process_library_with_romtag();
+    if (!_framed_output && !_number_of_jobs && !_output_pattern) {
+        write_all(1, buf, len);
         return;
     }
+    if (n->outbuf_len + len > n->outbuf_size) {
+        unsigned int size = (n->outbuf_size) ? n->outbuf_size : 0x10000;
+        while (n->outbuf_len + len > size) {
+            size *= 2;
+        }
+        n->outbuf = realloc(n->outbuf, size);
+        if (!n->outbuf) {
+            fprintf(stderr, "unable to allocate output buffer\n");
+            exit(1);
+        }
+        n->outbuf_size = size;
+    }
+    memcpy(n->outbuf+n->outbuf_len, buf, len);
+    n->outbuf_len += len;
+}
 
-    fprintf(stderr, "no ROMTag\n");
+/*
+ framed output, one record per utterance
 
+ 4 bytes utterance number, starting at 0 (big-endian)
+ 4 bytes number of samples (big-endian)
+ samples
+ */
 
-    m68k_write_memory_16(_mainbase, 0x4eb9); //jsr
-    m68k_write_memory_32(_mainbase+2, 0); //library init
+void write_frame(unsigned int number, unsigned char *buf, unsigned int len)
+{
+    unsigned char header[8];
+    unsigned int vals[2] = { number, len };
+    for (int i=0; i<2; i++) {
+        header[i*4] = vals[i]>>24;
+        header[i*4+1] = vals[i]>>16;
+        header[i*4+2] = vals[i]>>8;
+        header[i*4+3] = vals[i];
+    }
+    write_all(1, header, 8);
+    write_all(1, buf, len);
+}
 
-    m68k_write_memory_16(_mainbase+6, 0x7000); //moveq #$0, D0
-    m68k_write_memory_16(_mainbase+8, 0x2c7c); //movea.l xxx, A6
-    m68k_write_memory_32(_mainbase+10, _librarybase);
-    m68k_write_memory_16(_mainbase+14, 0x227c); //movea.l xxx, A1
-    m68k_write_memory_32(_mainbase+16, _narrator_rb);
-    m68k_write_memory_16(_mainbase+20, 0x4eb9); //jsr
-    _makelibrary = _mainbase+22;
-    m68k_write_memory_32(_makelibrary, 0); //Open function will be filled in by MakeLibrary
+// -o pattern, a printf format with a single %d (optionally with flags and width)
+int check_output_pattern(char *pattern)
+{
+    int number_of_conversions = 0;
+    for (char *p=pattern; *p; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        p++;
+        if (*p == '%') {
+            continue;
+        }
+        while ((*p == '0') || (*p == '-')) {
+            p++;
+        }
+        while ((*p >= '0') && (*p <= '9')) {
+            p++;
+        }
+        if (*p != 'd') {
+            return 0;
+        }
+        number_of_conversions++;
+    }
+    return (number_of_conversions == 1);
+}
 
-    m68k_write_memory_16(_mainbase+26, 0x23fc); //move.l #$xxxxxxxx, $xxxxxxxx
-    m68k_write_memory_32(_mainbase+28, _librarybase);
-    m68k_write_memory_32(_mainbase+32, _stackpointer);
-    m68k_write_memory_16(_mainbase+36, 0x4eb9); //jsr
-    _addtask = _mainbase+38;
-    m68k_write_memory_32(_addtask, 0); //address will be filled by AddTask
+void write_output_file(unsigned int number, unsigned char *buf, unsigned int len)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), _output_pattern, number);
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "unable to open '%s'\n", path);
+        exit(1);
+    }
+    write_all(fd, buf, len);
+    close(fd);
+}
 
-    m68k_write_memory_32(_mainbase+42, 0x4e722700); //stop $2700
+void write_sentence(int i);
 
-    m68k_write_memory_8(_narrator_rb+8, 5); // ln_Type NT_MESSAGE
-    m68k_write_memory_32(_narrator_rb+14, _msgport);
-    m68k_write_memory_16(_narrator_rb+18, 70); // size of narrator_rb (old version)
-    m68k_write_memory_32(_narrator_rb+20, _librarybase);
+// called when the device replies, the samples of the utterance are complete
+void finish_samples(struct narrator *n)
+{
+    if (_number_of_jobs) {
+        struct job *job = &_jobs[n->utterance_count];
+        if (_output_pattern && !job->split) {
+            write_output_file(job->record, n->outbuf, n->outbuf_len);
+            n->outbuf_len = 0;
+            return;
+        }
+        // hand the buffer over to the main thread
+        pthread_mutex_lock(&_job_mutex);
+        job->samples = n->outbuf;
+        job->len = n->outbuf_len;
+        job->done = 1;
+        pthread_cond_broadcast(&_job_done);
+        pthread_mutex_unlock(&_job_mutex);
+        n->outbuf = 0;
+        n->outbuf_len = 0;
+        n->outbuf_size = 0;
+        if (!_number_of_workers && (n->utterance_count+1 == _number_of_jobs)) {
+            // server mode without -j, all the sentences of a record are done
+            for (int i=0; i<_number_of_jobs; i++) {
+                write_sentence(i);
+                free(_jobs[i].samples);
+                free(_jobs[i].text);
+            }
+            _number_of_jobs = 0;
+            _next_job = 0;
+        }
+    } else if (_output_pattern) {
+        write_output_file(n->utterance_count, n->outbuf, n->outbuf_len);
+        n->outbuf_len = 0;
+    } else if (_framed_output) {
+        write_frame(n->utterance_count, n->outbuf, n->outbuf_len);
+        n->outbuf_len = 0;
+    }
+}
 
-    m68k_set_reg(M68K_REG_SP, _stackpointer);
+/*
+ -b, statistics for benchmarking, written as JSON when the process exits
 
-    strcpy(_ram+_libraryname, "narrator.device");
-    m68k_set_reg(M68K_REG_A1, _libraryname);
+ the init stage runs from the start until the device first asks for a
+ message, and every utterance from the GetMsg that hands it to the device
+ until the device replies to it, the first CMD_WRITE of an utterance is when a
+ player could start, see narrator_pull()
+ */
 
-    m68k_set_reg(M68K_REG_A2, _librarybase);
-    m68k_set_reg(M68K_REG_D0, 0);
-    m68k_set_reg(M68K_REG_A6, _execbase);
-    m68k_set_reg(M68K_REG_PC, _mainbase);
+struct stage {
+    double seconds; //wall clock
+    double cpu_seconds; //user and system time of the process
+    unsigned long long cycles;
+    unsigned long long instructions;
+    unsigned long long samples;
+    double first_sample_seconds; //wall clock until the first samples, 0 if none
+};
+
+static char *_stats_path = 0;
+static int _stats_init_done = 0;
+static struct stage _stats_init;
+static long _stats_init_peak_rss = 0; //KB
+static struct stage _stats_start; //counters at the start of the current stage
+static double _stats_first_sample = 0; //of the current utterance
+static struct stage *_stats_utterances = 0;
+static int _stats_number_of_utterances = 0;
+static int _stats_size = 0;
+
+double seconds_since(struct timespec *start, clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
-unsigned int m68k_read_memory_8(unsigned int addr)
+long peak_rss()
 {
-    if (addr >= MAX_RAM) {
-        fprintf(stderr, "m68k_read_memory_8 %x OUT OF BOUNDS\n", addr);
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
         return 0;
     }
-    unsigned int val = _ram[addr];
-//  fprintf(stderr, "m68k_read_memory_8 %x %x\n", addr, val);
-    return val;
+    return usage.ru_maxrss;
 }
 
-unsigned int m68k_read_memory_16(unsigned int addr)
+// the counters since the start of the process
+void read_counters(struct narrator *n, struct stage *s)
 {
-    if (addr >= MAX_RAM-1) {
-        fprintf(stderr, "m68k_read_memory_16 %x OUT OF BOUNDS\n", addr);
-        return 0;
-    }
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p;
-//  fprintf(stderr, "m68k_read_memory_16 %x %x\n", addr, val);
-    return val;
+    struct timespec zero = { 0, 0 };
+    s->seconds = seconds_since(&_start_time, CLOCK_MONOTONIC);
+    s->cpu_seconds = seconds_since(&zero, CLOCK_PROCESS_CPUTIME_ID);
+    // this may be called from a callback, in the middle of m68k_execute
+    s->cycles = narrator_cycles(n);
+#if M68K_INSTRUCTION_BUDGET
+    s->instructions = s->cycles;
+#else
+    s->instructions = n->instruction_count;
+#endif
+    s->samples = n->sample_count;
 }
 
-unsigned int m68k_read_memory_32(unsigned int addr)
+void start_stage(struct narrator *n)
 {
-    if (addr >= MAX_RAM-3) {
-        fprintf(stderr, "m68k_read_memory_32 %x OUT OF BOUNDS\n", addr);
-        return 0;
+    if (_stats_path) {
+        read_counters(n, &_stats_start);
+        _stats_first_sample = 0;
     }
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p;
-//  fprintf(stderr, "m68k_read_memory_32 %x %x\n", addr, val);
-    return val;
 }
 
-void m68k_write_memory_8(unsigned int addr, unsigned int val)
+void end_stage(struct narrator *n, struct stage *s)
+{
+    struct stage now;
+    read_counters(n, &now);
+    s->seconds = now.seconds - _stats_start.seconds;
+    s->cpu_seconds = now.cpu_seconds - _stats_start.cpu_seconds;
+    s->cycles = now.cycles - _stats_start.cycles;
+    s->instructions = now.instructions - _stats_start.instructions;
+    s->samples = now.samples - _stats_start.samples;
+    _stats_start = now;
+}
+
+// GetMsg, the first one ends the init stage
+void stats_get_msg(struct narrator *n)
 {
-    if (addr >= MAX_RAM) {
-        fprintf(stderr, "m68k_read_memory_8 %x OUT OF BOUNDS\n", addr);
+    if (!_stats_path || _stats_init_done) {
         return;
     }
-    fprintf(stderr, "m68k_write_memory_8 addr %x val %x\n", addr, val);
-    _ram[addr] = val;
+    end_stage(n, &_stats_init);
+    _stats_init_peak_rss = peak_rss();
+    _stats_init_done = 1;
 }
 
-void m68k_write_memory_16(unsigned int addr, unsigned int val)
+// ReplyMsg, the end of an utterance
+void stats_reply_msg(struct narrator *n)
 {
-    if (addr >= MAX_RAM-1) {
-        fprintf(stderr, "m68k_read_memory_16 %x OUT OF BOUNDS\n", addr);
+    if (!_stats_path) {
         return;
     }
-    fprintf(stderr, "m68k_write_memory_16 addr %x val %x\n", addr, val);
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    p[1] = val&0xff;
-    val >>= 8;
-    p[0] = val&0xff;
+    if (_stats_number_of_utterances == _stats_size) {
+        _stats_size = (_stats_size) ? _stats_size*2 : 1024;
+        _stats_utterances = realloc(_stats_utterances, _stats_size*sizeof(struct stage));
+        if (!_stats_utterances) {
+            fprintf(stderr, "unable to allocate statistics\n");
+            exit(1);
+        }
+    }
+    end_stage(n, &_stats_utterances[_stats_number_of_utterances]);
+    _stats_utterances[_stats_number_of_utterances++].first_sample_seconds = _stats_first_sample;
 }
 
-void m68k_write_memory_32(unsigned int addr, unsigned int val)
+// CMD_WRITE, the time to the first samples of an utterance
+void stats_put_samples(struct narrator *n)
 {
-    if (addr >= MAX_RAM-3) {
-        fprintf(stderr, "m68k_read_memory_32 %x OUT OF BOUNDS\n", addr);
+    if (!_stats_path || _stats_first_sample) {
         return;
     }
-    fprintf(stderr, "m68k_write_memory_32 addr %x val %x\n", addr, val);
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    p[3] = val&0xff;
-    val >>= 8;
-    p[2] = val&0xff;
-    val >>= 8;
-    p[1] = val&0xff;
-    val >>= 8;
-    p[0] = val&0xff;
+    _stats_first_sample = seconds_since(&_start_time, CLOCK_MONOTONIC) - _stats_start.seconds;
 }
 
-void m68k_write_memory_32_no_log(unsigned int addr, unsigned int val)
+// the fields of a stage, instructions are only counted by Musashi with
+// M68K_INSTRUCTION_BUDGET or M68K_INSTRUCTION_HOOK
+void write_stage(FILE *fp, struct stage *s, int sampfreq)
 {
-    if (addr >= MAX_RAM-3) {
-        fprintf(stderr, "m68k_read_memory_32 %x OUT OF BOUNDS\n", addr);
+    double audio_seconds = (double)s->samples / sampfreq;
+    fprintf(fp, "\"seconds\": %.6f, \"cpu_seconds\": %.6f", s->seconds, s->cpu_seconds);
+#if M68K_INSTRUCTION_BUDGET
+    fprintf(fp, ", \"cycles\": null");
+#else
+    fprintf(fp, ", \"cycles\": %llu", s->cycles);
+#endif
+#if M68K_INSTRUCTION_BUDGET || M68K_INSTRUCTION_HOOK
+    fprintf(fp, ", \"instructions\": %llu, \"instructions_per_sec\": %.0f", s->instructions, (s->cpu_seconds > 0) ? s->instructions / s->cpu_seconds : 0);
+#else
+    fprintf(fp, ", \"instructions\": null, \"instructions_per_sec\": null");
+#endif
+    fprintf(fp, ", \"samples\": %llu, \"audio_seconds\": %.6f, \"realtime_factor\": %.3f", s->samples, audio_seconds, (s->cpu_seconds > 0) ? audio_seconds / s->cpu_seconds : 0);
+}
+
+void write_statistics()
+{
+    struct narrator *n = _instances[0];
+    FILE *fp = fopen(_stats_path, "w");
+    if (!fp) {
+        fprintf(stderr, "unable to write statistics to '%s'\n", _stats_path);
         return;
     }
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    p[3] = val&0xff;
-    val >>= 8;
-    p[2] = val&0xff;
-    val >>= 8;
-    p[1] = val&0xff;
-    val >>= 8;
-    p[0] = val&0xff;
+    struct stage total;
+    memset(&total, 0, sizeof(total));
+    double max_first_sample = 0;
+    for (int i=0; i<_stats_number_of_utterances; i++) {
+        struct stage *s = &_stats_utterances[i];
+        total.first_sample_seconds += s->first_sample_seconds;
+        if (s->first_sample_seconds > max_first_sample) {
+            max_first_sample = s->first_sample_seconds;
+        }
+        total.seconds += s->seconds;
+        total.cpu_seconds += s->cpu_seconds;
+        total.cycles += s->cycles;
+        total.instructions += s->instructions;
+        total.samples += s->samples;
+    }
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"device\": \"%s\",\n", _library_path);
+    fprintf(fp, "  \"engine\": %d,\n", _engine);
+    fprintf(fp, "  \"sampfreq\": %d,\n", n->sampfreq);
+    fprintf(fp, "  \"init\": { ");
+    write_stage(fp, &_stats_init, n->sampfreq);
+    fprintf(fp, ", \"peak_rss_kb\": %ld },\n", _stats_init_peak_rss);
+    fprintf(fp, "  \"synthesis\": { \"utterances\": %d, ", _stats_number_of_utterances);
+    write_stage(fp, &total, n->sampfreq);
+    fprintf(fp, ", \"utterances_per_sec\": %.2f", (total.seconds > 0) ? _stats_number_of_utterances / total.seconds : 0);
+    fprintf(fp, ", \"mean_first_sample_seconds\": %.6f, \"max_first_sample_seconds\": %.6f", (_stats_number_of_utterances) ? total.first_sample_seconds / _stats_number_of_utterances : 0, max_first_sample);
+    fprintf(fp, ", \"peak_rss_kb\": %ld },\n", peak_rss());
+    fprintf(fp, "  \"utterances\": [");
+    for (int i=0; i<_stats_number_of_utterances; i++) {
+        fprintf(fp, "%s\n    { ", (i) ? "," : "");
+        write_stage(fp, &_stats_utterances[i], n->sampfreq);
+        fprintf(fp, ", \"first_sample_seconds\": %.6f }", _stats_utterances[i].first_sample_seconds);
+    }
+    fprintf(fp, "\n  ]\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
 }
 
-unsigned int m68k_read_disassembler_8(unsigned int addr)
+void print_statistics()
 {
-    if (addr >= MAX_RAM) {
-        fprintf(stderr, "m68k_read_disassembler_8 %x OUT OF BOUNDS\n", addr);
-        return 0;
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double seconds = (end_time.tv_sec - _start_time.tv_sec) + (end_time.tv_nsec - _start_time.tv_nsec) / 1e9;
+    unsigned long long cycles = 0;
+    unsigned long long instructions = 0;
+    unsigned int utterances = 0;
+    for (int i=0; i<_number_of_instances; i++) {
+        cycles += narrator_cycles(_instances[i]);
+        instructions += _instances[i]->instruction_count;
+        utterances += _instances[i]->utterances;
+    }
+#if M68K_INSTRUCTION_BUDGET
+    // m68k_execute() counts instructions instead of cycles
+    fprintf(stderr, "instructions %llu seconds %.3f instructions/sec %.0f\n", cycles, seconds, (seconds > 0) ? cycles / seconds : 0);
+#else
+    fprintf(stderr, "cycles %llu seconds %.3f cycles/sec %.0f\n", cycles, seconds, (seconds > 0) ? cycles / seconds : 0);
+#endif
+#if M68K_INSTRUCTION_HOOK && !M68K_INSTRUCTION_BUDGET
+    fprintf(stderr, "instructions %llu instructions/sec %.0f\n", instructions, (seconds > 0) ? instructions / seconds : 0);
+#endif
+    for (int i=0; i<_number_of_instances; i++) {
+        narrator_print_ram_usage(_instances[i]);
+    }
+    if (_server_mode) {
+        fprintf(stderr, "utterances %u workers %d utterances/sec %.2f\n", utterances, (_number_of_workers) ? _number_of_workers : 1, (seconds > 0) ? utterances / seconds : 0);
     }
-    unsigned int val = _ram[addr];
-//  fprintf(stderr, "m68k_read_disassembler_8 %x %x\n", addr, val);
-    return val;
 }
 
-unsigned int m68k_read_disassembler_16(unsigned int addr)
+// GetMsg, the utterance from the command line, or in server mode the next
+// one from stdin
+int get_input(struct narrator *n)
 {
-    if (addr >= MAX_RAM-1) {
-        fprintf(stderr, "m68k_read_disassembler_16 %x OUT OF BOUNDS\n", addr);
+    stats_get_msg(n);
+    if (_server_mode && !read_next_input(n)) {
         return 0;
     }
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p;
-//  fprintf(stderr, "m68k_read_disassembler_16 %x %x\n", addr, val);
-    return val;
+    start_stage(n);
+    return 1;
 }
 
-unsigned int m68k_read_disassembler_32(unsigned int addr)
+// CMD_WRITE
+void put_samples(struct narrator *n, unsigned char *buf, unsigned int len)
 {
-    if (addr >= MAX_RAM-3) {
-        fprintf(stderr, "m68k_read_disassembler_32 %x OUT OF BOUNDS\n", addr);
-        return 0;
+    stats_put_samples(n);
+    write_samples(n, buf, len);
+}
+
+// ReplyMsg, without server mode the one utterance is all there is
+void reply_msg(struct narrator *n)
+{
+    stats_reply_msg(n);
+    finish_samples(n);
+    if (!_server_mode) {
+        exit(1);
+    }
+}
+
+// the options and hooks that are the same for every instance
+void setup_instance(struct narrator *n)
+{
+    n->device_path = _library_path;
+    n->snapshot_path = _snapshot_path;
+    n->engine = _engine;
+    n->trace_level = _trace_level;
+    n->get_input = get_input;
+    n->put_samples = put_samples;
+    n->reply = reply_msg;
+}
+
+// framed output or -o of split text, all the sentences go in one frame or file
+static unsigned char *_stitched = 0;
+static unsigned int _stitched_len = 0;
+
+void put_output(unsigned char *buf, unsigned int len)
+{
+    if (!_framed_output && !_output_pattern) {
+        write_all(1, buf, len);
+        return;
+    }
+    _stitched = realloc(_stitched, _stitched_len+len);
+    if (!_stitched) {
+        fprintf(stderr, "unable to allocate output buffer\n");
+        exit(1);
+    }
+    memcpy(_stitched+_stitched_len, buf, len);
+    _stitched_len += len;
+}
+
+// the samples of sentence i of split text, and the pause after it, or after
+// the last sentence of the utterance, the frame or file of the utterance
+void write_sentence(int i)
+{
+    static unsigned char silence[0x1000];
+    struct job *job = &_jobs[i];
+    int last = (i+1 == _number_of_jobs) || (_jobs[i+1].record != job->record);
+    unsigned int len = job->len;
+    unsigned int gap = 0;
+    if (!last) {
+        if (_gap >= 0) {
+            gap = _gap;
+        } else {
+            len -= (len < -_gap) ? len : -_gap;
+        }
+    }
+    put_output(job->samples, len);
+    while (gap > 0) {
+        unsigned int part = (gap < sizeof(silence)) ? gap : sizeof(silence);
+        put_output(silence, part);
+        gap -= part;
+    }
+    if (last) {
+        if (_framed_output) {
+            write_frame(job->record, _stitched, _stitched_len);
+        } else if (_output_pattern) {
+            write_output_file(job->record, _stitched, _stitched_len);
+        }
+        _stitched_len = 0;
     }
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p;
-//  fprintf(stderr, "m68k_read_disassembler_32 %x %x\n", addr, val);
-    return val;
 }
 
-void make_hex(char *buf, unsigned int pc, unsigned int len)
+void *worker_thread(void *arg)
 {
-	char *p = buf;
-    for (int i=0; i<len; i+=2) {
+    struct narrator *n = arg;
+    narrator_init(n);
+    check_narrator(n);
+    if (_gap_needed && !_gap_known && (n == _instances[0])) {
+        measure_gap(n);
+    }
+    while (!n->finished) {
+        narrator_execute(n, 100000);
+    }
+    check_narrator(n);
+    return 0;
+}
+
+// -j, render all of stdin with a pool of workers, each with its own instance
+void run_workers(struct narrator *first)
+{
+    if (_split_text) {
+        split_jobs(first->inputptr);
+    } else {
+        read_jobs();
+    }
+    trace(TRACE_TRAPS, "%d jobs %d workers\n", _number_of_jobs, _number_of_workers);
+
+    pthread_t threads[MAX_WORKERS];
+    for (int i=0; i<_number_of_workers; i++) {
+        struct narrator *n = first;
         if (i > 0) {
-			*p++ = ' ';
-        }
-		sprintf(p, "%04x", m68k_read_memory_16(pc));
-		pc += 2;
-		p += 4;
-	}
-}
-
-void instr_hook_callback(unsigned int pc)
-{
-	char buf[256];
-	char buf2[256];
-
-    unsigned int sp = m68k_get_reg(0, M68K_REG_SP);
-
-	unsigned int instr_size = m68k_disassemble(buf, pc, M68K_CPU_TYPE_68000);
-	make_hex(buf2, pc, instr_size);
-    {
-        unsigned int a0 = m68k_get_reg(0, M68K_REG_A0);
-        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-        unsigned int a2 = m68k_get_reg(0, M68K_REG_A2);
-        unsigned int a3 = m68k_get_reg(0, M68K_REG_A3);
-        unsigned int a4 = m68k_get_reg(0, M68K_REG_A4);
-        unsigned int a5 = m68k_get_reg(0, M68K_REG_A5);
-        unsigned int a6 = m68k_get_reg(0, M68K_REG_A6);
-        fprintf(stderr, "Execute %03x: %-20s: %s (SP=%x A0=%x A1=%x A2=%x A3=%x A4=%x A5=%x A6=%x)\n", pc, buf2, buf, sp, a0, a1, a2, a3, a4, a5, a6);
-    }
-    unsigned int instr = m68k_read_memory_16(pc);
-    if (instr == 0x4eae) { //jsr
-        if (instr_size == 4) {
-            unsigned int a6 = m68k_get_reg(0, M68K_REG_A6);
-            unsigned int arg = m68k_read_memory_16(pc+2);
-            fprintf(stderr, "***** JSR %x A6=%x 4=%x\n", arg, a6, m68k_read_memory_32(4));
-            m68k_write_memory_16(0x10000+arg, 0x4e75); // rts
-            m68k_set_reg(M68K_REG_A6, _execbase);
-            if (arg == 0xff3a) { // AllocMem -$c6
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0); // byteSize
-                unsigned int d1 = m68k_get_reg(0, M68K_REG_D1); // attributes
-                fprintf(stderr, "***** AllocMem byteSize %x attributes %x _allocmem %x\n", d0, d1, _allocmem);
-                m68k_set_reg(M68K_REG_D0, _allocmem);
-                if (d0 % 4 != 0) {
-                    d0 /= 4;
-                    d0++;
-                    d0 *= 4;
-                }
-                _allocmem += d0;
-            } else if (arg == 0xfeb6) { // AllocSignal -$14a
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0); // signalNum
-                fprintf(stderr, "***** AllocSignal signalNum %x _allocsignal %x\n", d0, _allocsignal);
-                m68k_set_reg(M68K_REG_D0, _allocsignal);
-                // should check to see signal is available
-                _allocsignal--;
-            } else if (arg == 0xfeda) { // FindTask -$126
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                fprintf(stderr, "***** FindTask %x '%s'\n", a1, (a1) ? ((char *)(_ram+a1)) : "(a1 is 0)");
-                m68k_set_reg(M68K_REG_D0, _taskbase);
-            } else if (arg == 0xfee6) { // AddTask -$11a
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1); // task
-                unsigned int a2 = m68k_get_reg(0, M68K_REG_A2); // initialPC
-                unsigned int a3 = m68k_get_reg(0, M68K_REG_A3); // finalPC
-                fprintf(stderr, "***** AddTask task %x initialPC %x finalPC %x\n", a1, a2, a3);
-                m68k_set_reg(M68K_REG_D0, _taskbase);
-                m68k_write_memory_32(_addtask, a2); //set the jsr addr in _mainbase
-            } else if (arg == 0xffac) { // MakeLibrary -$54
-                unsigned int a0 = m68k_get_reg(0, M68K_REG_A0); // vectors
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1); // structure
-                unsigned int a2 = m68k_get_reg(0, M68K_REG_A2); // init
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0); // dSize
-                unsigned int d1 = m68k_get_reg(0, M68K_REG_D1); // segList
-                fprintf(stderr, "***** MakeLibrary vectors %x structure %x init %x dSize %x segList %x\n", a0, a1, a2, d0, d1);
-                m68k_set_reg(M68K_REG_D0, _librarybase);
-
-                unsigned int vectorbase = a0;
-                for (int i=0; i<8; i++) {
-                    unsigned int vector = m68k_read_memory_32(vectorbase+i*4);
-                    if (vector == 0xffffffff) {
-                        fprintf(stderr, "end of vectors\n");
-                        break;
-                    }
-                    fprintf(stderr, "vector[%d] = %x\n", i, vector);
-                    if (i == 0) {
-                        fprintf(stderr, "openfunc %x\n", vector);
-                        m68k_write_memory_32(_makelibrary, vector); //set the jsr addr in _mainbase
-                    }
-                }
-                
-            } else if (arg == 0xfe50) { // AddDevice -$1b0
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1); // device
-                fprintf(stderr, "***** AddDevice %x\n", a1);
-            } else if (arg == 0xfe44) { // OpenDevice -$1bc
-                unsigned int a0 = m68k_get_reg(0, M68K_REG_A0);
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                unsigned int d1 = m68k_get_reg(0, M68K_REG_D1);
-                fprintf(stderr, "***** OpenDevice devName %x '%s' unit %x ioRequest %x flags %x\n", a0, _ram+a0, d0, a1, d1);
-                m68k_set_reg(M68K_REG_D0, 0);
-                m68k_write_memory_32(a1+14, _audiomsgport);
-            } else if (arg == 0xfe92) { // PutMsg -$16e
-                unsigned int a0 = m68k_get_reg(0, M68K_REG_A0);
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                fprintf(stderr, "***** PutMsg port %x message %x\n", a0, a1);
-            } else if (arg == 0xfe38) {
-                // DoIO -$1c8
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                fprintf(stderr, "***** DoIO ioRequest %x\n", a1);
-                unsigned int io_Unit = m68k_read_memory_32(a1+24);
-                fprintf(stderr, "***** DoIO io_Unit %x\n", io_Unit);
-                unsigned int io_Command = m68k_read_memory_16(a1+28);
-                fprintf(stderr, "***** DoIO io_Command %x\n", io_Command);
-                fprintf(stderr, "***** DoIO io_Flags %x\n", m68k_read_memory_8(a1+30));
-                fprintf(stderr, "***** DoIO io_Error %x\n", m68k_read_memory_8(a1+31));
-                unsigned int ioa_Data = m68k_read_memory_32(a1+34);
-                fprintf(stderr, "***** DoIO ioa_Data %x\n", ioa_Data);
-                unsigned int ioa_Length = m68k_read_memory_32(a1+38);
-                fprintf(stderr, "***** DoIO ioa_Length %x\n", ioa_Length);
-                unsigned int ioa_Period = m68k_read_memory_16(a1+42);
-                fprintf(stderr, "***** DoIO ioa_Period %x\n", ioa_Period);
-                unsigned int ioa_Volume = m68k_read_memory_16(a1+44);
-                fprintf(stderr, "***** DoIO ioa_Volume %x\n", ioa_Volume);
-                unsigned int ioa_Cycles = m68k_read_memory_16(a1+46);
-                fprintf(stderr, "***** DoIO ioa_Cycles %x\n", ioa_Cycles);
-                if (io_Command == 6) { //CMD_STOP
-                    fprintf(stderr, "***** DoIO CMD_STOP\n");
-                } else if (io_Command == 7) { //CMD_START
-                    fprintf(stderr, "***** DoIO CMD_START\n");
-                } else if (io_Command == 9) { //ADCMD_FREE
-                    fprintf(stderr, "***** DoIO ADCMD_FREE mn_ReplyPort %x\n", m68k_read_memory_32(a1+14));
-                    fprintf(stderr, "***** DoIO ADCMD_FREE io_Device %x\n", m68k_read_memory_32(a1+20));
-                    m68k_write_memory_8(a1+31, 0);
-                }
-                m68k_set_reg(M68K_REG_D0, 0);
-            } else if (arg == 0xfebc) { // Signal -$144
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
-                fprintf(stderr, "***** Signal task %x signalSet %x\n", a1, d0);
-            } else if (arg == 0xfe86) { // ReplyMsg -$17a
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                fprintf(stderr, "***** ReplyMsg message %x\n", a1);
-                fprintf(stderr, "***** io_Error %x\n", m68k_read_memory_8(_narrator_rb+31));
-                exit(1);
-            } else if (arg == 0xfe8c) { // GetMsg -$174
-                unsigned int a0 = m68k_get_reg(0, M68K_REG_A0);
-                fprintf(stderr, "***** GetMsg port %x\n", a0);
-                int len = strlen(_inputptr);
-                if (len >= INPUT_BUFSIZE) {
-                    len = INPUT_BUFSIZE;
-                }
-                strncpy(_ram+_inputbase, _inputptr, INPUT_BUFSIZE);
-                m68k_write_memory_16(_narrator_rb+28, 3); // CMD_WRITE 3 //io_Command
-                m68k_write_memory_32(_narrator_rb+44, 0); //io_Offset
-                m68k_write_memory_32(_narrator_rb+40, _inputbase); //io_Data
-                m68k_write_memory_32(_narrator_rb+36, len); //io_length
-                m68k_write_memory_16(_narrator_rb+48, _rate_parameter); //rate
-                m68k_write_memory_16(_narrator_rb+50, _pitch_parameter); //pitch
-                m68k_write_memory_16(_narrator_rb+52, _mode_parameter); //mode 0 natural 1 robotic 2 manual
-                m68k_write_memory_16(_narrator_rb+54, _sex_parameter); //sex 0 male 1 female
-                m68k_write_memory_16(_narrator_rb+62, _volume_parameter); //volume 0-64
-                m68k_write_memory_16(_narrator_rb+64, _sampfreq_parameter); //sampfreq
-
-                m68k_write_memory_8(_audiochanbase, 3);//not necessary to have all these values
-                m68k_write_memory_8(_audiochanbase, 5);
-                m68k_write_memory_8(_audiochanbase, 10);
-                m68k_write_memory_8(_audiochanbase, 12);
-                m68k_write_memory_32(_narrator_rb+56, _audiochanbase);//ch_masks
-                m68k_write_memory_16(_narrator_rb+60, 4);//nm_masks
-                m68k_write_memory_16(_narrator_rb+31, 0); //io_Error
-
-                m68k_set_reg(M68K_REG_D0, _narrator_rb);
-            } else if (arg == 0xfec2) { // Wait -$13e
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
-                fprintf(stderr, "***** Wait signalSet %x\n", d0);
-                unsigned int a2 = m68k_get_reg(0, M68K_REG_A2);
-                fprintf(stderr, "***** Wait A2 %x\n", a2);
-                fprintf(stderr, "***** Wait A2+0x22 %x\n", a2+0x22);
-                fprintf(stderr, "***** Wait (A2+0x22) %x\n", m68k_read_memory_32(a2+0x22));
-                m68k_set_reg(M68K_REG_A2, _librarybase);
-            } else if (arg == 0xffe2) { // device BeginIO -$1e
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                fprintf(stderr, "***** device BeginIO %x\n", a1);
-                unsigned int io_Unit = m68k_read_memory_32(a1+24);
-                fprintf(stderr, "***** BeginIO io_Unit %x\n", io_Unit);
-                unsigned int io_Command = m68k_read_memory_16(a1+28);
-                fprintf(stderr, "***** BeginIO io_Command %x\n", io_Command);
-                fprintf(stderr, "***** BeginIO io_Flags %x\n", m68k_read_memory_8(a1+30));
-                fprintf(stderr, "***** BeginIO io_Error %x\n", m68k_read_memory_8(a1+31));
-                unsigned int ioa_Data = m68k_read_memory_32(a1+34);
-                fprintf(stderr, "***** BeginIO ioa_Data %x\n", ioa_Data);
-                unsigned int ioa_Length = m68k_read_memory_32(a1+38);
-                fprintf(stderr, "***** BeginIO ioa_Length %x\n", ioa_Length);
-                unsigned int ioa_Period = m68k_read_memory_16(a1+42);
-                fprintf(stderr, "***** BeginIO ioa_Period %x\n", ioa_Period);
-                unsigned int ioa_Volume = m68k_read_memory_16(a1+44);
-                fprintf(stderr, "***** BeginIO ioa_Volume %x\n", ioa_Volume);
-                unsigned int ioa_Cycles = m68k_read_memory_16(a1+46);
-                fprintf(stderr, "***** BeginIO ioa_Cycles %x\n", ioa_Cycles);
-                for (int i=0; i<ioa_Length; i++) {
-                    fprintf(stderr, "***** BeginIO ioa_Data %d %x\n", i, m68k_read_memory_8(ioa_Data+i));
-                }
-                if (io_Command == 32) {//ADCMD_ALLOCATE
-                    fprintf(stderr, "***** BeginIO ADCMD_ALLOCATE\n");
-                    m68k_write_memory_8(a1+31, 0);
-                    m68k_write_memory_32(a1+24, 0x8/*0xc*/);//io_Unit
-                    m68k_write_memory_16(a1+32, 0xaaaa);//ioa_AllocKey
-                } else if (io_Command == 3) {//CMD_WRITE
-                    fprintf(stderr, "***** BeginIO CMD_WRITE\n");
-                    write(1, _ram+ioa_Data, ioa_Length);
-                }
-            } else if (arg == 0xfe26) { // WaitIO
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                fprintf(stderr, "***** WaitIO %x\n", a1);
-                m68k_set_reg(M68K_REG_D0, 0);
-            } else if (arg == 0xff2e) { // FreeMem
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
-                fprintf(stderr, "***** FreeMem memoryBlock %x byteSize %x\n", a1, d0);
-            } else if (arg == 0xfed4) { // SetTaskPri
-                unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
-                fprintf(stderr, "***** SetTaskPri task %x priority %x\n", a1, d0);
-            } else if (arg == 0xfeb0) { // FreeSignal
-                unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
-                fprintf(stderr, "***** FreeSignal signalNum %x\n", d0);
-            } else {
-                fprintf(stderr, "unhandled\n");
-                exit(1);
-            }
+            n = new_narrator();
+            narrator_set_params(n, &_params);
+            setup_instance(n);
         }
-    } else if (instr == 0x4e72) {
-        fprintf(stderr, "***** Stop\n");
-        exit(1);
+        _instances[i] = n;
+        _number_of_instances = i+1;
+        if (pthread_create(&threads[i], 0, worker_thread, n)) {
+            fprintf(stderr, "unable to create worker %d\n", i);
+            exit(1);
+        }
+    }
+
+    // write in input order, with -o the workers have already written the
+    // files of the utterances that were not split
+    for (int i=0; i<_number_of_jobs; i++) {
+        if (_output_pattern && !_jobs[i].split) {
+            continue;
+        }
+        pthread_mutex_lock(&_job_mutex);
+        while (!_jobs[i].done || (_jobs[i].split && !_gap_known)) {
+            pthread_cond_wait(&_job_done, &_job_mutex);
+        }
+        pthread_mutex_unlock(&_job_mutex);
+        if (_jobs[i].split) {
+            write_sentence(i);
+        } else if (_framed_output) {
+            write_frame(_jobs[i].record, _jobs[i].samples, _jobs[i].len);
+        } else {
+            write_all(1, _jobs[i].samples, _jobs[i].len);
+        }
+        free(_jobs[i].samples);
+        _jobs[i].samples = 0;
+    }
+
+    for (int i=0; i<_number_of_workers; i++) {
+        pthread_join(threads[i], 0);
     }
 }
 
 void main(int argc, char **argv)
 {
+    struct narrator *n = new_narrator();
+    narrator_default_params(&_params);
+
     for (int i=1; i<argc; i++) {
         if (!strcmp(argv[i], "-")) {
             fprintf(stderr, "reading first line from stdin\n");
-            if (!fgets(_inputbuf, INPUT_BUFSIZE, stdin)) {
+            char *line = 0;
+            size_t size = 0;
+            ssize_t len = getline(&line, &size, stdin);
+            if (len < 0) {
                 fprintf(stderr, "no input\n");
                 exit(1);
             }
-            int len = strlen(_inputbuf);
-            if (len > 0) {
-                if (_inputbuf[len-1] == '\n') {
-                    _inputbuf[len-1] = 0;
-                }
+            if ((len > 0) && (line[len-1] == '\n')) {
+                line[len-1] = 0;
             }
-            _inputptr = _inputbuf;
-        } else if (!strcmp(argv[i], "-d")) {
+            n->inputptr = line;
+        } else if (!strcmp(argv[i], "-S")) {
+            _server_mode = 1;
+        } else if (!strcmp(argv[i], "-0")) {
+            _server_mode = 1;
+            _record_delimiter = 0;
+        } else if (!strcmp(argv[i], "-F")) {
+            _framed_output = 1;
+        } else if (!strcmp(argv[i], "-j")) {
             if (i+1 < argc) {
-                _library_path = argv[i+1];
+                long val = strtol(argv[i+1], 0, 10);
+                if ((val < 1) || (val > MAX_WORKERS)) {
+                    fprintf(stderr, "error, number of workers out of range (1-%d)\n", MAX_WORKERS);
+                    exit(1);
+                }
+                _number_of_workers = val;
                 i++;
             } else {
-                fprintf(stderr, "error, expecting path for -d\n");
+                fprintf(stderr, "error, expecting number of workers for -j\n");
                 exit(1);
             }
-        } else if (!strcmp(argv[i], "-f")) {
+        } else if (!strcmp(argv[i], "-o")) {
             if (i+1 < argc) {
-                long val = strtol(argv[i+1], 0, 10);
-                if ((val < 5000) || (val > 28000)) {
-                    fprintf(stderr, "error, sampling_frequency out of range (5000-28000)\n");
+                if (!check_output_pattern(argv[i+1])) {
+                    fprintf(stderr, "error, output pattern needs exactly one %%d\n");
                     exit(1);
                 }
-                _sampfreq_parameter = val;
+                _output_pattern = argv[i+1];
+                _server_mode = 1;
                 i++;
             } else {
-                fprintf(stderr, "error, expecting sampling_frequency for -f\n");
+                fprintf(stderr, "error, expecting output pattern for -o\n");
                 exit(1);
             }
-        } else if (!strcmp(argv[i], "-m")) {
+        } else if (!strcmp(argv[i], "-b")) {
             if (i+1 < argc) {
-                long val = strtol(argv[i+1], 0, 10);
-                if ((val < 0) || (val > 1)) {
-                    fprintf(stderr, "error, invalid mode (0-1)\n");
-                    exit(1);
-                }
-                _mode_parameter = val;
+                _stats_path = argv[i+1];
                 i++;
             } else {
-                fprintf(stderr, "error, expecting mode for -m\n");
+                fprintf(stderr, "error, expecting path for -b\n");
                 exit(1);
             }
-        } else if (!strcmp(argv[i], "-p")) {
+        } else if (!strcmp(argv[i], "-c")) {
+            if (i+1 < argc) {
+                _snapshot_path = argv[i+1];
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting path for -c\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-e")) {
             if (i+1 < argc) {
                 long val = strtol(argv[i+1], 0, 10);
-                if ((val < 65) || (val > 320)) {
-                    fprintf(stderr, "error, pitch out of range (65-320)\n");
+                if ((val < M68K_JIT_OFF) || (val > M68K_JIT_VERIFY)) {
+                    fprintf(stderr, "error, invalid engine (0-2)\n");
                     exit(1);
                 }
-                _pitch_parameter = val;
+                _engine = val;
                 i++;
             } else {
-                fprintf(stderr, "error, expecting pitch for -p\n");
+                fprintf(stderr, "error, expecting engine for -e\n");
                 exit(1);
             }
-        } else if (!strcmp(argv[i], "-r")) {
+        } else if (!strcmp(argv[i], "-t")) {
             if (i+1 < argc) {
                 long val = strtol(argv[i+1], 0, 10);
-                if ((val < 40) || (val > 400)) {
-                    fprintf(stderr, "error, rate out of range (40-400)\n");
+                if ((val < TRACE_OFF) || (val > TRACE_FULL)) {
+                    fprintf(stderr, "error, invalid trace level (0-2)\n");
                     exit(1);
                 }
-                _rate_parameter = val;
+                _trace_level = val;
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting trace level for -t\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-d")) {
+            if (i+1 < argc) {
+                _library_path = argv[i+1];
                 i++;
             } else {
-                fprintf(stderr, "error, expecting rate for -r\n");
+                fprintf(stderr, "error, expecting path for -d\n");
                 exit(1);
             }
-        } else if (!strcmp(argv[i], "-s")) {
+        } else if (!strcmp(argv[i], "-g")) {
             if (i+1 < argc) {
                 long val = strtol(argv[i+1], 0, 10);
-                if ((val < 0) || (val > 1)) {
-                    fprintf(stderr, "error, invalid sex (0-1)\n");
+                if ((val < 0) || (val > 10000)) {
+                    fprintf(stderr, "error, pause out of range (0-10000)\n");
                     exit(1);
                 }
-                _sex_parameter = val;
+                _gap_ms = val;
                 i++;
             } else {
-                fprintf(stderr, "error, expecting sex for -s\n");
+                fprintf(stderr, "error, expecting pause for -g\n");
                 exit(1);
             }
+        } else if (parse_speech_option(&_params, argc, argv, &i)) {
         } else {
-            _inputptr = argv[i];
+            n->inputptr = argv[i];
         }
     }
 
-    if (!_inputptr) {
+    if (_number_of_workers && !n->inputptr) {
+        _server_mode = 1;
+    }
+    if (!n->inputptr && !_server_mode) {
         fprintf(stderr, "Usage: %s [options] <-|phonetic_text>\n", argv[0]);
+        fprintf(stderr, "       %s [options] -S\n", argv[0]);
         fprintf(stderr, "\n");
         fprintf(stderr, "Options:\n");
+        fprintf(stderr, "-0 server mode with NUL-delimited records instead of lines\n");
+        fprintf(stderr, "-b statistics_file, write the time, cycles and samples of init and of every utterance as JSON\n");
+        fprintf(stderr, "-c snapshot_file (created after the first init, then used to skip init)\n");
         fprintf(stderr, "-d narrator_device_file\n");
+        fprintf(stderr, "-e engine (0=interpreter 1=jit 2=jit checked against the interpreter)\n");
         fprintf(stderr, "-f sampling_frequency (5000-28000)\n");
+        fprintf(stderr, "-F framed output, each utterance is preceded by its number and length\n");
+        fprintf(stderr, "-g pause (0-10000 ms) between the sentences of split phonetic text (measured if not given)\n");
+        fprintf(stderr, "-j number_of_workers (1-%d), speak stdin on that many threads, output stays in order,\n", MAX_WORKERS);
+        fprintf(stderr, "   or split the phonetic text into sentences and speak them on that many threads\n");
         fprintf(stderr, "-m mode (0=natural 1=robotic)\n");
+        fprintf(stderr, "-o output_pattern, write each utterance of stdin to its own file (for example line%%05d.s8)\n");
         fprintf(stderr, "-p pitch (65-320)\n");
         fprintf(stderr, "-r rate (40-400)\n");
         fprintf(stderr, "-s sex (0=male 1=female)\n");
+        fprintf(stderr, "-S server mode, speak each line from stdin until end of input\n");
+        fprintf(stderr, "-t trace level (0=off 1=traps 2=every instruction)\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Examples:\n");
         fprintf(stderr, "\n");
@@ -849,6 +960,7 @@ void main(int argc, char **argv)
         fprintf(stderr, "%s -d narrator.device~1.1 \"/HEH4LOW WER4LD.\"\n", argv[0]);
         fprintf(stderr, "%s -d narrator.device~1.2 \"/HEH4LOW WER4LD.\"\n", argv[0]);
         fprintf(stderr, "%s -d narrator.device~2.04 \"/HEH4LOW WER4LD.\"\n", argv[0]);
+        fprintf(stderr, "%s -c narrator.snapshot \"/HEH4LOW WER4LD.\"\n", argv[0]);
         
         fprintf(stderr, "\n");
         fprintf(stderr, "# read from stdin\n");
@@ -859,33 +971,79 @@ void main(int argc, char **argv)
         fprintf(stderr, "%s -d narrator.device~1.2 -\n", argv[0]);
         fprintf(stderr, "%s -d narrator.device~2.04 -\n", argv[0]);
         fprintf(stderr, "\n");
+        fprintf(stderr, "# keep the device loaded and speak every line from stdin\n");
+        fprintf(stderr, "%s -S\n", argv[0]);
+        fprintf(stderr, "%s -p 110 -r 150 -f 22200 -s 1 -m 1 -S\n", argv[0]);
+        fprintf(stderr, "%s -S -F\n", argv[0]);
+        fprintf(stderr, "%s -0 -F\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "# speak every line from stdin on 8 threads\n");
+        fprintf(stderr, "%s -j 8\n", argv[0]);
+        fprintf(stderr, "%s -j 8 -o line%%05d.s8\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "# split a long utterance into sentences and speak them on 4 threads\n");
+        fprintf(stderr, "%s -j 4 -\n", argv[0]);
+        fprintf(stderr, "\n");
         fprintf(stderr, "PCM samples will be written to stdout.\n");
         fprintf(stderr, "The format is S8 (signed 8-bit) at 22200 Hz\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "If using Linux, play using ALSA: aplay -f S8 -r 22200\n");
         fprintf(stderr, "\n");
-        fprintf(stderr, "Redirect stderr to /dev/null to speed up process\n");
+        fprintf(stderr, "Use -t 1 or -t 2 to trace what the device is doing on stderr\n");
 
         exit(1);
     }
 
+    set_speech_params(n, &_params);
 
-    for (int i=0; i<MAX_RAM; i++) {
-        _ram[i] = 0;
+    clock_gettime(CLOCK_MONOTONIC, &_start_time);
+    if (_trace_level >= TRACE_TRAPS) {
+        atexit(print_statistics);
+    }
+    if (_gap_ms >= 0) {
+        _gap = _gap_ms * n->sampfreq / 1000;
+        _gap_known = 1;
     }
-    load_library();
 
-    m68k_init();
-    m68k_set_instr_hook_callback(instr_hook_callback);
-    m68k_set_cpu_type(M68K_CPU_TYPE_68000);
-    m68k_pulse_reset();
+    // a single utterance that is split into sentences, see split_jobs
+    if (n->inputptr && !_server_mode && (_number_of_workers || (strlen(n->inputptr) >= INPUT_BUFSIZE))) {
+        _split_text = 1;
+        _server_mode = 1;
+        if (!_number_of_workers) {
+            _number_of_workers = 1;
+        }
+    }
 
-    process_hunks();
-    process_library();
+    // the workers would all count into the same statistics, and the first
+    // one also measures the pause between sentences
+    if (_stats_path) {
+        if (_number_of_workers) {
+            fprintf(stderr, "error, -b cannot be used with -j or with an utterance longer than %d bytes\n", INPUT_BUFSIZE-1);
+            exit(1);
+        }
+        atexit(write_statistics);
+    }
+#if !M68K_INSTRUCTION_HOOK
+    if (_trace_level >= TRACE_FULL) {
+        fprintf(stderr, "instruction trace needs Musashi built with M68K_INSTRUCTION_HOOK\n");
+    }
+#endif
 
-    for(;;) {
-        m68k_execute(100000);
+    setup_instance(n);
+    if (_number_of_workers) {
+        run_workers(n);
+        exit(0);
+    }
+
+    _instances[0] = n;
+    _number_of_instances = 1;
+    narrator_init(n);
+    check_narrator(n);
+
+    while (!n->finished) {
+        narrator_execute(n, 100000);
     }
+    check_narrator(n);
 
     exit(0);
 }
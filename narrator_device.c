@@ -0,0 +1,1268 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+
+#include "m68k.h"
+#include "memmap.h"
+#include "narrator_device.h"
+
+// every function that traces has the instance in n
+#define trace(level, ...) do { if (n->trace_level >= (level)) { fprintf(stderr, __VA_ARGS__); } } while (0)
+
+#define INPUT_BUFSIZE NARRATOR_INPUT_BUFSIZE
+#define LIBRARY_BUFSIZE NARRATOR_LIBRARY_BUFSIZE
+
+#define MAX_RAM (16*1024*1024)
+
+static unsigned int _inputbase = 0x28000;
+static unsigned int _execbase = 0x20000;
+static unsigned int _narrator_rb = 0x22000;
+static unsigned int _msgport = 0x22800;
+static unsigned int _audiomsgport = 0x22c00;
+static unsigned int _librarybase = 0x23000;
+static unsigned int _audiochanbase = 0x24000;
+static unsigned int _taskbase = 0x25000;
+static unsigned int _mainbase = 0x26000;
+static unsigned int _stackpointer = 0x1f000;
+static unsigned int _libraryname = 0x27000;
+static unsigned int _audiodevbase = 0x29800;
+static unsigned int _hunkbase = 0x30000; //the device is loaded above the fake os, up to allocmem
+
+// the instance cannot go on, the reason is kept in n->error, while loading
+// this returns from narrator_init(), and while running it finishes the
+// instance and ends the timeslice, but returns to the caller, so the current
+// instruction is completed: a faulting read gives 0 and a faulting write is
+// dropped (see memmap_read_slow()), a trap returns without its result, and
+// whatever the instruction then does to the registers or ram only changes an
+// instance that is never run again, as every loop stops at n->finished
+static void fail(struct narrator *n, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(n->error, sizeof(n->error), fmt, args);
+    va_end(args);
+    trace(TRACE_TRAPS, "error: %s\n", n->error);
+    if (n->init_jmp) {
+        longjmp(*(jmp_buf *)n->init_jmp, 1);
+    }
+    n->finished = 1;
+    m68k_end_timeslice();
+}
+
+// the instance whose cpu context is switched in on this thread
+static struct narrator *current_narrator()
+{
+    return memmap_get_current()->owner;
+}
+
+static void memory_fault(struct memmap *map, unsigned int addr, int size, int write)
+{
+    fail(map->owner, "%s of %d bits at %x out of bounds", write ? "write" : "read", size, addr);
+}
+
+struct narrator *narrator_new()
+{
+    struct narrator *n = calloc(1, sizeof(struct narrator));
+    if (!n) {
+        return 0;
+    }
+    // anonymous memory is zero filled by the kernel a page at a time, on
+    // first use, so only the part the device touches is ever allocated,
+    // and it is page aligned so that a snapshot can be mapped on top of it
+    n->ram = mmap(0, MAX_RAM, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (n->ram == MAP_FAILED) {
+        free(n);
+        return 0;
+    }
+    memmap_init(&n->memmap);
+    memmap_map_ram(&n->memmap, 0, MAX_RAM, n->ram);
+    n->memmap.fault = memory_fault;
+    n->memmap.owner = n;
+    // zeroed, so that narrator_close() can free it even if init never got to it
+    n->cpu_context = calloc(1, m68k_context_size());
+    if (!n->cpu_context) {
+        munmap(n->ram, MAX_RAM);
+        free(n);
+        return 0;
+    }
+    n->device_path = "narrator.device";
+    n->engine = M68K_JIT_OFF;
+    n->pitch = 110;
+    n->rate = 150;
+    n->volume = 64;
+    n->sampfreq = 22200;
+    n->sex = 0;
+    n->mode = 0;
+    n->allocmem = 0x100000;
+    n->allocsignal = 31;
+    return n;
+}
+
+static void load_library(struct narrator *n)
+{
+    trace(TRACE_TRAPS, "opening '%s'\n", n->device_path);
+    FILE *fp = fopen(n->device_path, "rb");
+    if (!fp) {
+        fail(n, "unable to open '%s'", n->device_path);
+    }
+    int result = fread(n->library_buf, 1, LIBRARY_BUFSIZE, fp);
+    trace(TRACE_TRAPS, "fread %d (0x%x)\n", result, result);
+    n->library_size = result;
+    n->library_pos = 0;
+    fclose(fp);
+}
+
+static unsigned int library_read_32(struct narrator *n)
+{
+    if (n->library_pos >= n->library_size-3) {
+        fail(n, "library_read_32 past end of file %x", n->library_pos);
+    }
+    uint8_t *p = (uint8_t *) &n->library_buf[n->library_pos];
+    n->library_pos += 4;
+    unsigned int val;
+    val = *p++;
+    val <<= 8;
+    val |= *p++;
+    val <<= 8;
+    val |= *p++;
+    val <<= 8;
+    val |= *p;
+    return val;
+}
+
+// called when an utterance has been replied to
+// memory allocated since the first GetMsg is reclaimed if all of it was freed
+static void finish_utterance(struct narrator *n)
+{
+    if (n->alloc_outstanding == 0) {
+        if (n->allocmem > n->allocmark) {
+            trace(TRACE_TRAPS, "reclaiming memory %x-%x\n", n->allocmark, n->allocmem);
+            memset(n->ram+n->allocmark, 0, n->allocmem-n->allocmark);
+        }
+        n->allocmem = n->allocmark;
+        n->allocsignal = n->allocsignalmark;
+    } else {
+        trace(TRACE_TRAPS, "%d allocations still outstanding, keeping memory up to %x\n", n->alloc_outstanding, n->allocmem);
+        n->allocmark = n->allocmem;
+        n->allocsignalmark = n->allocsignal;
+        n->alloc_outstanding = 0;
+    }
+}
+
+// CMD_WRITE while narrator_pull() is waiting, the samples are copied because
+// the device reuses its buffers, and m68k_execute returns once there are enough
+static void pull_samples(struct narrator *n, unsigned char *buf, unsigned int len)
+{
+    if (n->pull_pos > 0) {
+        memmove(n->pullbuf, n->pullbuf+n->pull_pos, n->pull_len-n->pull_pos);
+        n->pull_len -= n->pull_pos;
+        n->pull_pos = 0;
+    }
+    if (n->pull_len + len > n->pull_size) {
+        unsigned int size = (n->pull_size) ? n->pull_size : 0x10000;
+        while (n->pull_len + len > size) {
+            size *= 2;
+        }
+        unsigned char *pullbuf = realloc(n->pullbuf, size);
+        if (!pullbuf) {
+            fail(n, "unable to allocate pull buffer");
+            return;
+        }
+        n->pullbuf = pullbuf;
+        n->pull_size = size;
+    }
+    memcpy(n->pullbuf+n->pull_len, buf, len);
+    n->pull_len += len;
+    if (n->pull_len >= n->pull_want) {
+        m68k_end_timeslice();
+    }
+}
+
+/*
+ exec.library and audio.device calls are made through fake jump tables,
+ where every entry is
+
+   illegal ; rts ; (unused)
+
+ and the illegal instruction is dispatched by illegal_instruction_callback()
+ */
+
+#define TRAP_OPCODE 0x4afc
+#define NUMBER_OF_EXEC_LVOS 170
+#define NUMBER_OF_AUDIO_LVOS 8
+
+static void make_jump_table(unsigned int base, int number_of_lvos)
+{
+    for (int i=1; i<=number_of_lvos; i++) {
+        m68k_write_memory_32_no_log(base-i*6, (TRAP_OPCODE<<16)|0x4e75);
+    }
+}
+
+static void make_jump_tables(struct narrator *n)
+{
+    make_jump_table(_execbase, NUMBER_OF_EXEC_LVOS);
+    make_jump_table(_audiodevbase, NUMBER_OF_AUDIO_LVOS);
+    // AbsExecBase, for a device that does move.l 4.w,a6
+    m68k_write_memory_32_no_log(4, _execbase);
+}
+
+static void process_hunks(struct narrator *n)
+{
+    unsigned int number_of_hunks = 0;
+    unsigned int memory_pos = _hunkbase;
+    unsigned int hunk_index = 0;
+    unsigned int hunk_end = 0;
+
+    // the relocations of every hunk, applied once all the hunks are loaded
+    unsigned int reloc32_pos[NARRATOR_MAX_HUNKS] = { 0 };
+
+    for(;;) {
+        unsigned int hunk_id = library_read_32(n);
+        if (hunk_id == 0x3f3) {
+            trace(TRACE_TRAPS, "found HUNK_HEADER 0x3f3\n");
+            unsigned int zero = library_read_32(n);
+            if (zero != 0) {
+                fail(n, "expecting 0");
+            }
+            number_of_hunks = library_read_32(n);
+            trace(TRACE_TRAPS, "number_of_hunks %d\n", number_of_hunks);
+            if (number_of_hunks > NARRATOR_MAX_HUNKS) {
+                fail(n, "too many hunks %d", number_of_hunks);
+            }
+            unsigned int first_hunk = library_read_32(n);
+            trace(TRACE_TRAPS, "first_hunk %d\n", first_hunk);
+            unsigned int last_hunk = library_read_32(n);
+            trace(TRACE_TRAPS, "last_hunk %d\n", last_hunk);
+            for (int i=first_hunk; i<=last_hunk; i++) {
+                unsigned int hunk_size = library_read_32(n);
+                trace(TRACE_TRAPS, "hunk %d size 0x%x\n", i, hunk_size);
+            }
+        } else if (hunk_id == 0x3e9) {
+            trace(TRACE_TRAPS, "found HUNK_CODE 0x3e9\n");
+            unsigned int number_of_longwords = library_read_32(n);
+            trace(TRACE_TRAPS, "number_of_longwords 0x%x\n", number_of_longwords);
+            if (hunk_index >= number_of_hunks) {
+                fail(n, "unexpected hunk");
+            }
+            n->library_hunk_base[hunk_index] = memory_pos;
+            hunk_index++;
+            for (int i=0; i<number_of_longwords; i++) {
+                unsigned int val = library_read_32(n);
+                m68k_write_memory_32_no_log(memory_pos, val);
+                memory_pos += 4;
+            }
+        } else if (hunk_id == 0x3ec) {
+            trace(TRACE_TRAPS, "found HUNK_RELOC32 0x3ec\n");
+            if (hunk_index == 0) {
+                fail(n, "HUNK_RELOC32 before any hunk");
+            }
+            reloc32_pos[hunk_index-1] = n->library_pos;
+            for(;;) {
+                unsigned int number_of_offsets = library_read_32(n);
+                trace(TRACE_TRAPS, "number_of_offsets %d\n", number_of_offsets);
+                if (!number_of_offsets) {
+                    break;
+                }
+                unsigned int hunk_number = library_read_32(n);
+                trace(TRACE_TRAPS, "hunk_number %d\n", hunk_number);
+                for (int i=0; i<number_of_offsets; i++) {
+                    unsigned int offset = library_read_32(n);
+//                    fprintf(stderr, "offset %d 0x%x\n", i, offset);
+                }
+            }
+        } else if (hunk_id == 0x3f2) {
+            trace(TRACE_TRAPS, "found HUNK_END 0x3f2\n");
+            hunk_end++;
+            if (hunk_end == number_of_hunks) {
+                trace(TRACE_TRAPS, "end of hunks\n");
+                break;
+            }
+        } else if (hunk_id == 0x3ea) {
+            trace(TRACE_TRAPS, "found HUNK_DATA 0x3ea\n");
+            unsigned int number_of_longwords = library_read_32(n);
+            trace(TRACE_TRAPS, "number_of_longwords 0x%x\n", number_of_longwords);
+            if (hunk_index >= number_of_hunks) {
+                fail(n, "unexpected hunk");
+            }
+            n->library_hunk_base[hunk_index] = memory_pos;
+            hunk_index++;
+            for (int i=0; i<number_of_longwords; i++) {
+                unsigned int val = library_read_32(n);
+                m68k_write_memory_32_no_log(memory_pos, val);
+                memory_pos += 4;
+            }
+        } else if (hunk_id == 0x3eb) {
+            trace(TRACE_TRAPS, "found HUNK_BSS 0x3eb\n");
+            unsigned int number_of_longwords = library_read_32(n);
+            trace(TRACE_TRAPS, "number_of_longwords 0x%x\n", number_of_longwords);
+            if (hunk_index >= number_of_hunks) {
+                fail(n, "unexpected hunk");
+            }
+            n->library_hunk_base[hunk_index] = memory_pos;
+            hunk_index++;
+            memory_pos += 4*number_of_longwords;
+        } else {
+            fail(n, "unhandled hunk type %x", hunk_id);
+        }
+    }
+
+    if (memory_pos > n->allocmem) {
+        fail(n, "device too large, loaded up to %x", memory_pos);
+    }
+
+    // the offsets are in the hunk the relocations follow
+    for (int hunk=0; hunk<hunk_index; hunk++) {
+        if (!reloc32_pos[hunk]) {
+            continue;
+        }
+        n->library_pos = reloc32_pos[hunk];
+        for(;;) {
+            unsigned int number_of_offsets = library_read_32(n);
+            trace(TRACE_TRAPS, "number_of_offsets %d\n", number_of_offsets);
+            if (!number_of_offsets) {
+                break;
+            }
+            unsigned int hunk_number = library_read_32(n);
+            trace(TRACE_TRAPS, "hunk_number %d\n", hunk_number);
+            if (hunk_number >= hunk_index) {
+                fail(n, "hunk_number too high");
+            }
+            for (int i=0; i<number_of_offsets; i++) {
+                unsigned int offset = n->library_hunk_base[hunk] + library_read_32(n);
+//                fprintf(stderr, "reloc32 offset %d 0x%x\n", i, offset);
+                unsigned int val = m68k_read_memory_32(offset);
+                val += n->library_hunk_base[hunk_number];
+                m68k_write_memory_32_no_log(offset, val);
+            }
+        }
+    }
+}
+
+static void process_library_with_romtag(struct narrator *n)
+{
+    unsigned int romtagbase = _hunkbase+4;
+    trace(TRACE_TRAPS, "rt_MatchWord 0x4afc\n");
+    trace(TRACE_TRAPS, "rt_MatchTag 0x%x\n", m68k_read_memory_32(romtagbase+2));
+    trace(TRACE_TRAPS, "rt_EndSkip 0x%x\n", m68k_read_memory_32(romtagbase+6));
+    unsigned int rt_Flags = m68k_read_memory_8(romtagbase+10);
+    trace(TRACE_TRAPS, "rt_Flags 0x%x\n", rt_Flags);
+    unsigned int rtf_AutoInit = 0;
+    if (rt_Flags & (1<<7)) {
+        rtf_AutoInit = 1;
+        trace(TRACE_TRAPS, "rt_Flags RTF_AUTOINIT\n");
+    }
+    if (rt_Flags & (1<<2)) {
+        trace(TRACE_TRAPS, "rt_Flags RTF_AFTERDOS\n");
+    }
+    if (rt_Flags & (1<<1)) {
+        trace(TRACE_TRAPS, "rt_Flags RTF_SINGLETASK\n");
+    }
+    if (rt_Flags & (1<<0)) {
+        trace(TRACE_TRAPS, "rt_Flags RTF_COLDSTART\n");
+    }
+    trace(TRACE_TRAPS, "rt_Version 0x%x\n", m68k_read_memory_8(romtagbase+11));
+    trace(TRACE_TRAPS, "rt_Type 0x%x\n", m68k_read_memory_8(romtagbase+12));
+    trace(TRACE_TRAPS, "rt_Pri 0x%x\n", m68k_read_memory_8(romtagbase+13));
+    unsigned int rt_Name = m68k_read_memory_32(romtagbase+14);
+    trace(TRACE_TRAPS, "rt_Name 0x%x '%s'\n", rt_Name, n->ram+rt_Name);
+    unsigned int rt_IdString = m68k_read_memory_32(romtagbase+18);
+    trace(TRACE_TRAPS, "rt_IdString 0x%x '%s'\n", rt_IdString, n->ram+rt_IdString);
+    unsigned int rt_Init = m68k_read_memory_32(romtagbase+22);
+    trace(TRACE_TRAPS, "rt_Init 0x%x\n", rt_Init);
+
+
+
+    m68k_write_memory_16(_mainbase, 0x4eb9); //jsr
+    m68k_write_memory_32(_mainbase+2, rt_Init);
+
+    m68k_write_memory_16(_mainbase+6, 0x7000); //moveq #$0, D0
+    m68k_write_memory_16(_mainbase+8, 0x2c7c); //movea.l xxx, A6
+    m68k_write_memory_32(_mainbase+10, _librarybase);
+    m68k_write_memory_16(_mainbase+14, 0x227c); //movea.l xxx, A1
+    m68k_write_memory_32(_mainbase+16, _narrator_rb);
+
+    m68k_write_memory_16(_mainbase+20, 0x4eb9); //jsr
+    n->makelibrary = _mainbase+22;
+    m68k_write_memory_32(n->makelibrary, 0); //Open function will be filled in by MakeLibrary
+
+    m68k_write_memory_16(_mainbase+26, 0x23fc); //move.l #$xxxxxxxx, $xxxxxxxx
+    m68k_write_memory_32(_mainbase+28, _librarybase);
+    m68k_write_memory_32(_mainbase+32, _stackpointer);
+
+    m68k_write_memory_16(_mainbase+36, 0x4eb9); //jsr
+    n->addtask = _mainbase+38;
+    m68k_write_memory_32(n->addtask, 0); //address will be filled in by AddTask
+
+    n->stoppc = _mainbase+42;
+    m68k_write_memory_16(n->stoppc, TRAP_OPCODE);
+
+    m68k_write_memory_8(_narrator_rb+8, 5); // ln_Type NT_MESSAGE
+    m68k_write_memory_32(_narrator_rb+14, _msgport);
+    m68k_write_memory_16(_narrator_rb+18, 70); // size of narrator_rb (old version)
+    m68k_write_memory_32(_narrator_rb+20, _librarybase);
+
+    m68k_set_reg(M68K_REG_SP, _stackpointer);
+
+
+    m68k_set_reg(M68K_REG_A1, rt_Name);
+    m68k_set_reg(M68K_REG_A2, _librarybase);
+    m68k_set_reg(M68K_REG_D0, 0);
+    m68k_set_reg(M68K_REG_A6, _execbase);
+    m68k_set_reg(M68K_REG_PC, _mainbase);
+}
+
+static void process_library(struct narrator *n)
+{
+    make_jump_tables(n);
+
+    if ((n->ram[_hunkbase+4] == 0x4a) && (n->ram[_hunkbase+5] == 0xfc)) {
+        trace(TRACE_TRAPS, "ROMTag found\n");
+        process_library_with_romtag(n);
+        return;
+    }
+
+    trace(TRACE_TRAPS, "no ROMTag\n");
+
+
+    m68k_write_memory_16(_mainbase, 0x4eb9); //jsr
+    m68k_write_memory_32(_mainbase+2, _hunkbase); //library init
+
+    m68k_write_memory_16(_mainbase+6, 0x7000); //moveq #$0, D0
+    m68k_write_memory_16(_mainbase+8, 0x2c7c); //movea.l xxx, A6
+    m68k_write_memory_32(_mainbase+10, _librarybase);
+    m68k_write_memory_16(_mainbase+14, 0x227c); //movea.l xxx, A1
+    m68k_write_memory_32(_mainbase+16, _narrator_rb);
+    m68k_write_memory_16(_mainbase+20, 0x4eb9); //jsr
+    n->makelibrary = _mainbase+22;
+    m68k_write_memory_32(n->makelibrary, 0); //Open function will be filled in by MakeLibrary
+
+    m68k_write_memory_16(_mainbase+26, 0x23fc); //move.l #$xxxxxxxx, $xxxxxxxx
+    m68k_write_memory_32(_mainbase+28, _librarybase);
+    m68k_write_memory_32(_mainbase+32, _stackpointer);
+    m68k_write_memory_16(_mainbase+36, 0x4eb9); //jsr
+    n->addtask = _mainbase+38;
+    m68k_write_memory_32(n->addtask, 0); //address will be filled by AddTask
+
+    n->stoppc = _mainbase+42;
+    m68k_write_memory_16(n->stoppc, TRAP_OPCODE);
+
+    m68k_write_memory_8(_narrator_rb+8, 5); // ln_Type NT_MESSAGE
+    m68k_write_memory_32(_narrator_rb+14, _msgport);
+    m68k_write_memory_16(_narrator_rb+18, 70); // size of narrator_rb (old version)
+    m68k_write_memory_32(_narrator_rb+20, _librarybase);
+
+    m68k_set_reg(M68K_REG_SP, _stackpointer);
+
+    strcpy(n->ram+_libraryname, "narrator.device");
+    m68k_set_reg(M68K_REG_A1, _libraryname);
+
+    m68k_set_reg(M68K_REG_A2, _librarybase);
+    m68k_set_reg(M68K_REG_D0, 0);
+    m68k_set_reg(M68K_REG_A6, _execbase);
+    m68k_set_reg(M68K_REG_PC, _mainbase);
+}
+
+/*
+ snapshot file, the state of the emulator at the first GetMsg after the
+ device has been initialized
+
+ struct snapshot_header
+ struct snapshot_range[number_of_ranges]
+ (padding to pagesize)
+ ram pages for each range, at file_offset
+
+ the ram pages are mapped copy-on-write on top of n->ram when restoring, so
+ pagesize is that of the host, at least SNAPSHOT_MIN_PAGESIZE, and a snapshot
+ saved with another one is recreated
+ */
+
+#define SNAPSHOT_MAGIC "NARRSNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_MIN_PAGESIZE 4096
+
+static int _snapshot_regs[] = {
+    M68K_REG_SR, M68K_REG_USP, M68K_REG_ISP,
+    M68K_REG_D0, M68K_REG_D1, M68K_REG_D2, M68K_REG_D3,
+    M68K_REG_D4, M68K_REG_D5, M68K_REG_D6, M68K_REG_D7,
+    M68K_REG_A0, M68K_REG_A1, M68K_REG_A2, M68K_REG_A3,
+    M68K_REG_A4, M68K_REG_A5, M68K_REG_A6, M68K_REG_A7,
+    M68K_REG_PC
+};
+#define SNAPSHOT_NUM_REGS (sizeof(_snapshot_regs)/sizeof(_snapshot_regs[0]))
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t pagesize;
+    uint64_t device_hash;
+    uint32_t device_size;
+    uint32_t ram_size;
+    uint32_t regs[SNAPSHOT_NUM_REGS];
+    uint32_t allocmem;
+    uint32_t allocsignal;
+    uint32_t addtask;
+    uint32_t makelibrary;
+    uint32_t stoppc;
+    uint32_t number_of_ranges;
+};
+
+struct snapshot_range {
+    uint32_t addr;
+    uint32_t size;
+    uint32_t file_offset;
+};
+
+// FNV-1a over the device file
+static uint64_t library_hash(struct narrator *n)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i=0; i<n->library_size; i++) {
+        hash ^= n->library_buf[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static unsigned int snapshot_pagesize()
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    return (pagesize > SNAPSHOT_MIN_PAGESIZE) ? pagesize : SNAPSHOT_MIN_PAGESIZE;
+}
+
+static int ram_page_is_zero(struct narrator *n, unsigned int addr, unsigned int pagesize)
+{
+    uint64_t *p = (uint64_t *) &n->ram[addr];
+    for (int i=0; i<pagesize/8; i++) {
+        if (p[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// pc is where execution resumes when the snapshot is restored, returns 0
+// if the instance failed
+static int save_snapshot(struct narrator *n, unsigned int pc)
+{
+    unsigned int pagesize = snapshot_pagesize();
+    struct snapshot_range *ranges = malloc(MAX_RAM/pagesize*sizeof(struct snapshot_range));
+    if (!ranges) {
+        fail(n, "unable to allocate snapshot ranges");
+        return 0;
+    }
+    unsigned int number_of_ranges = 0;
+    for (unsigned int addr=0; addr<MAX_RAM; addr+=pagesize) {
+        if (ram_page_is_zero(n, addr, pagesize)) {
+            continue;
+        }
+        if (number_of_ranges && (ranges[number_of_ranges-1].addr+ranges[number_of_ranges-1].size == addr)) {
+            ranges[number_of_ranges-1].size += pagesize;
+        } else {
+            ranges[number_of_ranges].addr = addr;
+            ranges[number_of_ranges].size = pagesize;
+            number_of_ranges++;
+        }
+    }
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.version = SNAPSHOT_VERSION;
+    header.pagesize = pagesize;
+    header.device_hash = library_hash(n);
+    header.device_size = n->library_size;
+    header.ram_size = MAX_RAM;
+    for (int i=0; i<SNAPSHOT_NUM_REGS; i++) {
+        header.regs[i] = m68k_get_reg(0, _snapshot_regs[i]);
+    }
+    header.regs[SNAPSHOT_NUM_REGS-1] = pc;
+    header.allocmem = n->allocmem;
+    header.allocsignal = n->allocsignal;
+    header.addtask = n->addtask;
+    header.makelibrary = n->makelibrary;
+    header.stoppc = n->stoppc;
+    header.number_of_ranges = number_of_ranges;
+
+    unsigned int file_offset = sizeof(header) + number_of_ranges*sizeof(struct snapshot_range);
+    file_offset = (file_offset + pagesize-1) & ~(pagesize-1);
+    for (int i=0; i<number_of_ranges; i++) {
+        ranges[i].file_offset = file_offset;
+        file_offset += ranges[i].size;
+    }
+
+    // every instance saves its own, to a temporary file that is renamed, so
+    // instances that save at the same time replace the file with the same
+    // contents, and a concurrent reader never sees a partial snapshot
+    char tmppath[1024];
+    snprintf(tmppath, sizeof(tmppath), "%s.%d.%lx", n->snapshot_path, getpid(), (unsigned long) n);
+    FILE *fp = fopen(tmppath, "wb");
+    if (!fp) {
+        free(ranges);
+        fail(n, "unable to write snapshot '%s'", tmppath);
+        return 0;
+    }
+    int ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    if (number_of_ranges) {
+        ok = ok && (fwrite(ranges, sizeof(struct snapshot_range), number_of_ranges, fp) == number_of_ranges);
+        ok = ok && (fseek(fp, ranges[0].file_offset, SEEK_SET) == 0);
+    }
+    for (int i=0; ok && (i<number_of_ranges); i++) {
+        ok = (fwrite(n->ram+ranges[i].addr, 1, ranges[i].size, fp) == ranges[i].size);
+    }
+    if (fclose(fp) != 0) {
+        ok = 0;
+    }
+    if (!ok || (rename(tmppath, n->snapshot_path) != 0)) {
+        unlink(tmppath);
+        free(ranges);
+        fail(n, "unable to write snapshot '%s'", n->snapshot_path);
+        return 0;
+    }
+    free(ranges);
+    trace(TRACE_TRAPS, "saved snapshot '%s' pc %x ranges %d size 0x%x\n", n->snapshot_path, pc, number_of_ranges, file_offset);
+    return 1;
+}
+
+// returns 1 if the emulator state was restored from the snapshot, a snapshot
+// that cannot be used is traced and then saved again
+static int load_snapshot(struct narrator *n)
+{
+    int fd = open(n->snapshot_path, O_RDONLY);
+    if (fd < 0) {
+        trace(TRACE_TRAPS, "no snapshot '%s'\n", n->snapshot_path);
+        return 0;
+    }
+    unsigned int pagesize = snapshot_pagesize();
+    struct snapshot_header header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        trace(TRACE_TRAPS, "snapshot '%s' is truncated\n", n->snapshot_path);
+        close(fd);
+        return 0;
+    }
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, 8) || (header.version != SNAPSHOT_VERSION)
+        || (header.pagesize != pagesize) || (header.ram_size != MAX_RAM)) {
+        trace(TRACE_TRAPS, "snapshot '%s' has a different format\n", n->snapshot_path);
+        close(fd);
+        return 0;
+    }
+    if ((header.device_size != n->library_size) || (header.device_hash != library_hash(n))) {
+        trace(TRACE_TRAPS, "snapshot '%s' is for a different device\n", n->snapshot_path);
+        close(fd);
+        return 0;
+    }
+    if (header.number_of_ranges > MAX_RAM/pagesize) {
+        trace(TRACE_TRAPS, "snapshot '%s' is corrupt\n", n->snapshot_path);
+        close(fd);
+        return 0;
+    }
+    size_t ranges_size = header.number_of_ranges*sizeof(struct snapshot_range);
+    struct snapshot_range *ranges = malloc(ranges_size ? ranges_size : 1);
+    if (!ranges) {
+        close(fd);
+        fail(n, "unable to allocate snapshot ranges");
+    }
+    if (pread(fd, ranges, ranges_size, sizeof(header)) != ranges_size) {
+        trace(TRACE_TRAPS, "snapshot '%s' is truncated\n", n->snapshot_path);
+        free(ranges);
+        close(fd);
+        return 0;
+    }
+    // everything mmap() could refuse, or fault on later, is checked before
+    // the first range replaces any ram, so that a cold start is still possible
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        st.st_size = 0;
+    }
+    for (int i=0; i<header.number_of_ranges; i++) {
+        if ((ranges[i].addr % pagesize) || (ranges[i].size % pagesize) || (ranges[i].file_offset % pagesize)
+            || (ranges[i].addr > MAX_RAM) || (ranges[i].size > MAX_RAM-ranges[i].addr)
+            || ((off_t) ranges[i].file_offset + ranges[i].size > st.st_size)) {
+            trace(TRACE_TRAPS, "snapshot '%s' is corrupt\n", n->snapshot_path);
+            free(ranges);
+            close(fd);
+            return 0;
+        }
+    }
+    for (int i=0; i<header.number_of_ranges; i++) {
+        void *p = mmap(n->ram+ranges[i].addr, ranges[i].size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, ranges[i].file_offset);
+        if (p == MAP_FAILED) {
+            // ram may already be partially replaced, cannot fall back to a cold start
+            free(ranges);
+            close(fd);
+            fail(n, "unable to map snapshot '%s'", n->snapshot_path);
+        }
+    }
+    free(ranges);
+    close(fd);
+
+    for (int i=0; i<SNAPSHOT_NUM_REGS; i++) {
+        m68k_set_reg(_snapshot_regs[i], header.regs[i]);
+    }
+    n->allocmem = header.allocmem;
+    n->allocsignal = header.allocsignal;
+    n->addtask = header.addtask;
+    n->makelibrary = header.makelibrary;
+    n->stoppc = header.stoppc;
+    n->snapshot_done = 1;
+    trace(TRACE_TRAPS, "restored snapshot '%s' pc %x ranges %d\n", n->snapshot_path, header.regs[SNAPSHOT_NUM_REGS-1], header.number_of_ranges);
+    return 1;
+}
+
+// how much of the emulated ram the device has actually touched
+void narrator_print_ram_usage(struct narrator *n)
+{
+    memmap_print_ram_usage(n->ram, MAX_RAM);
+}
+
+#if M68K_INSTRUCTION_HOOK
+static void instr_hook_callback(unsigned int pc)
+{
+    struct narrator *n = current_narrator();
+    n->instruction_count++;
+    if (n->trace_level >= TRACE_FULL) {
+        memmap_trace_instruction(pc);
+    }
+}
+#endif
+
+// pc is the jump table entry, arg is the LVO as an unsigned 16-bit value
+static void library_call(struct narrator *n, unsigned int pc, unsigned int arg)
+{
+    unsigned int a6 = m68k_get_reg(0, M68K_REG_A6);
+    trace(TRACE_TRAPS, "***** JSR %x A6=%x 4=%x\n", arg, a6, m68k_read_memory_32(4));
+    m68k_set_reg(M68K_REG_A6, _execbase);
+    if (arg == 0xff3a) { // AllocMem -$c6
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0); // byteSize
+        unsigned int d1 = m68k_get_reg(0, M68K_REG_D1); // attributes
+        trace(TRACE_TRAPS, "***** AllocMem byteSize %x attributes %x n->allocmem %x\n", d0, d1, n->allocmem);
+        m68k_set_reg(M68K_REG_D0, n->allocmem);
+        if (d0 % 4 != 0) {
+            d0 /= 4;
+            d0++;
+            d0 *= 4;
+        }
+        n->allocmem += d0;
+        if (n->allocmark) {
+            n->alloc_outstanding++;
+        }
+    } else if (arg == 0xfeb6) { // AllocSignal -$14a
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0); // signalNum
+        trace(TRACE_TRAPS, "***** AllocSignal signalNum %x n->allocsignal %x\n", d0, n->allocsignal);
+        m68k_set_reg(M68K_REG_D0, n->allocsignal);
+        // should check to see signal is available
+        n->allocsignal--;
+    } else if (arg == 0xfeda) { // FindTask -$126
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        trace(TRACE_TRAPS, "***** FindTask %x '%s'\n", a1, (a1) ? ((char *)(n->ram+a1)) : "(a1 is 0)");
+        m68k_set_reg(M68K_REG_D0, _taskbase);
+    } else if (arg == 0xfee6) { // AddTask -$11a
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1); // task
+        unsigned int a2 = m68k_get_reg(0, M68K_REG_A2); // initialPC
+        unsigned int a3 = m68k_get_reg(0, M68K_REG_A3); // finalPC
+        trace(TRACE_TRAPS, "***** AddTask task %x initialPC %x finalPC %x\n", a1, a2, a3);
+        m68k_set_reg(M68K_REG_D0, _taskbase);
+        m68k_write_memory_32(n->addtask, a2); //set the jsr addr in _mainbase
+    } else if (arg == 0xffac) { // MakeLibrary -$54
+        unsigned int a0 = m68k_get_reg(0, M68K_REG_A0); // vectors
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1); // structure
+        unsigned int a2 = m68k_get_reg(0, M68K_REG_A2); // init
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0); // dSize
+        unsigned int d1 = m68k_get_reg(0, M68K_REG_D1); // segList
+        trace(TRACE_TRAPS, "***** MakeLibrary vectors %x structure %x init %x dSize %x segList %x\n", a0, a1, a2, d0, d1);
+        m68k_set_reg(M68K_REG_D0, _librarybase);
+
+        unsigned int vectorbase = a0;
+        for (int i=0; i<8; i++) {
+            unsigned int vector = m68k_read_memory_32(vectorbase+i*4);
+            if (vector == 0xffffffff) {
+                trace(TRACE_TRAPS, "end of vectors\n");
+                break;
+            }
+            trace(TRACE_TRAPS, "vector[%d] = %x\n", i, vector);
+            if (i == 0) {
+                trace(TRACE_TRAPS, "openfunc %x\n", vector);
+                m68k_write_memory_32(n->makelibrary, vector); //set the jsr addr in _mainbase
+            }
+            m68k_write_memory_16(_librarybase-(i+1)*6, 0x4ef9); //jmp
+            m68k_write_memory_32(_librarybase-(i+1)*6+2, vector);
+        }
+    } else if (arg == 0xfe50) { // AddDevice -$1b0
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1); // device
+        trace(TRACE_TRAPS, "***** AddDevice %x\n", a1);
+    } else if (arg == 0xfe44) { // OpenDevice -$1bc
+        unsigned int a0 = m68k_get_reg(0, M68K_REG_A0);
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        unsigned int d1 = m68k_get_reg(0, M68K_REG_D1);
+        trace(TRACE_TRAPS, "***** OpenDevice devName %x '%s' unit %x ioRequest %x flags %x\n", a0, n->ram+a0, d0, a1, d1);
+        m68k_set_reg(M68K_REG_D0, 0);
+        m68k_write_memory_32(a1+14, _audiomsgport);
+        m68k_write_memory_32(a1+20, _audiodevbase); //io_Device, for BeginIO through the jump table
+    } else if (arg == 0xfe92) { // PutMsg -$16e
+        unsigned int a0 = m68k_get_reg(0, M68K_REG_A0);
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        trace(TRACE_TRAPS, "***** PutMsg port %x message %x\n", a0, a1);
+    } else if (arg == 0xfe38) {
+        // DoIO -$1c8
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        trace(TRACE_TRAPS, "***** DoIO ioRequest %x\n", a1);
+        unsigned int io_Unit = m68k_read_memory_32(a1+24);
+        trace(TRACE_TRAPS, "***** DoIO io_Unit %x\n", io_Unit);
+        unsigned int io_Command = m68k_read_memory_16(a1+28);
+        trace(TRACE_TRAPS, "***** DoIO io_Command %x\n", io_Command);
+        trace(TRACE_TRAPS, "***** DoIO io_Flags %x\n", m68k_read_memory_8(a1+30));
+        trace(TRACE_TRAPS, "***** DoIO io_Error %x\n", m68k_read_memory_8(a1+31));
+        unsigned int ioa_Data = m68k_read_memory_32(a1+34);
+        trace(TRACE_TRAPS, "***** DoIO ioa_Data %x\n", ioa_Data);
+        unsigned int ioa_Length = m68k_read_memory_32(a1+38);
+        trace(TRACE_TRAPS, "***** DoIO ioa_Length %x\n", ioa_Length);
+        unsigned int ioa_Period = m68k_read_memory_16(a1+42);
+        trace(TRACE_TRAPS, "***** DoIO ioa_Period %x\n", ioa_Period);
+        unsigned int ioa_Volume = m68k_read_memory_16(a1+44);
+        trace(TRACE_TRAPS, "***** DoIO ioa_Volume %x\n", ioa_Volume);
+        unsigned int ioa_Cycles = m68k_read_memory_16(a1+46);
+        trace(TRACE_TRAPS, "***** DoIO ioa_Cycles %x\n", ioa_Cycles);
+        if (io_Command == 6) { //CMD_STOP
+            trace(TRACE_TRAPS, "***** DoIO CMD_STOP\n");
+        } else if (io_Command == 7) { //CMD_START
+            trace(TRACE_TRAPS, "***** DoIO CMD_START\n");
+        } else if (io_Command == 9) { //ADCMD_FREE
+            trace(TRACE_TRAPS, "***** DoIO ADCMD_FREE mn_ReplyPort %x\n", m68k_read_memory_32(a1+14));
+            trace(TRACE_TRAPS, "***** DoIO ADCMD_FREE io_Device %x\n", m68k_read_memory_32(a1+20));
+            m68k_write_memory_8(a1+31, 0);
+        }
+        m68k_set_reg(M68K_REG_D0, 0);
+    } else if (arg == 0xfebc) { // Signal -$144
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
+        trace(TRACE_TRAPS, "***** Signal task %x signalSet %x\n", a1, d0);
+    } else if (arg == 0xfe86) { // ReplyMsg -$17a
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        trace(TRACE_TRAPS, "***** ReplyMsg message %x\n", a1);
+        trace(TRACE_TRAPS, "***** io_Error %x\n", m68k_read_memory_8(_narrator_rb+31));
+        if (n->reply) {
+            n->reply(n);
+        }
+        n->utterances++;
+        n->utterance_count++;
+        finish_utterance(n);
+    } else if (arg == 0xfe8c) { // GetMsg -$174
+        unsigned int a0 = m68k_get_reg(0, M68K_REG_A0);
+        trace(TRACE_TRAPS, "***** GetMsg port %x\n", a0);
+        if (n->snapshot_path && !n->snapshot_done) {
+            n->snapshot_done = 1;
+            if (!save_snapshot(n, pc)) {
+                return;
+            }
+        }
+        if (!n->allocmark) {
+            n->allocmark = n->allocmem;
+            n->allocsignalmark = n->allocsignal;
+        }
+        if (n->get_input) {
+            if (!n->get_input(n)) {
+                trace(TRACE_TRAPS, "end of input\n");
+                // m68k_execute returns after this instruction
+                n->finished = 1;
+                m68k_end_timeslice();
+                return;
+            }
+        } else if (n->pending) {
+            n->inputptr = n->pending;
+            n->pending = 0;
+            n->waiting = 0;
+        } else {
+            // nothing to speak yet, the GetMsg is made again by the next
+            // narrator_execute(), after this one returns
+            trace(TRACE_TRAPS, "waiting for input\n");
+            n->waiting = 1;
+            m68k_set_reg(M68K_REG_PC, pc);
+            m68k_end_timeslice();
+            return;
+        }
+        // not necessarily terminated within the buffer, see narrator_speak()
+        int len = strnlen(n->inputptr, INPUT_BUFSIZE);
+        strncpy(n->ram+_inputbase, n->inputptr, INPUT_BUFSIZE);
+        m68k_write_memory_16(_narrator_rb+28, 3); // CMD_WRITE 3 //io_Command
+        m68k_write_memory_32(_narrator_rb+44, 0); //io_Offset
+        m68k_write_memory_32(_narrator_rb+40, _inputbase); //io_Data
+        m68k_write_memory_32(_narrator_rb+36, len); //io_length
+        m68k_write_memory_16(_narrator_rb+48, n->rate); //rate
+        m68k_write_memory_16(_narrator_rb+50, n->pitch); //pitch
+        m68k_write_memory_16(_narrator_rb+52, n->mode); //mode 0 natural 1 robotic 2 manual
+        m68k_write_memory_16(_narrator_rb+54, n->sex); //sex 0 male 1 female
+        m68k_write_memory_16(_narrator_rb+62, n->volume); //volume 0-64
+        m68k_write_memory_16(_narrator_rb+64, n->sampfreq); //sampfreq
+
+        m68k_write_memory_8(_audiochanbase, 3);//not necessary to have all these values
+        m68k_write_memory_8(_audiochanbase, 5);
+        m68k_write_memory_8(_audiochanbase, 10);
+        m68k_write_memory_8(_audiochanbase, 12);
+        m68k_write_memory_32(_narrator_rb+56, _audiochanbase);//ch_masks
+        m68k_write_memory_16(_narrator_rb+60, 4);//nm_masks
+        m68k_write_memory_16(_narrator_rb+31, 0); //io_Error
+
+        m68k_set_reg(M68K_REG_D0, _narrator_rb);
+    } else if (arg == 0xfec2) { // Wait -$13e
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
+        trace(TRACE_TRAPS, "***** Wait signalSet %x\n", d0);
+        unsigned int a2 = m68k_get_reg(0, M68K_REG_A2);
+        trace(TRACE_TRAPS, "***** Wait A2 %x\n", a2);
+        trace(TRACE_TRAPS, "***** Wait A2+0x22 %x\n", a2+0x22);
+        trace(TRACE_TRAPS, "***** Wait (A2+0x22) %x\n", m68k_read_memory_32(a2+0x22));
+        m68k_set_reg(M68K_REG_A2, _librarybase);
+    } else if (arg == 0xffe2) { // device BeginIO -$1e
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        trace(TRACE_TRAPS, "***** device BeginIO %x\n", a1);
+        unsigned int io_Unit = m68k_read_memory_32(a1+24);
+        trace(TRACE_TRAPS, "***** BeginIO io_Unit %x\n", io_Unit);
+        unsigned int io_Command = m68k_read_memory_16(a1+28);
+        trace(TRACE_TRAPS, "***** BeginIO io_Command %x\n", io_Command);
+        trace(TRACE_TRAPS, "***** BeginIO io_Flags %x\n", m68k_read_memory_8(a1+30));
+        trace(TRACE_TRAPS, "***** BeginIO io_Error %x\n", m68k_read_memory_8(a1+31));
+        unsigned int ioa_Data = m68k_read_memory_32(a1+34);
+        trace(TRACE_TRAPS, "***** BeginIO ioa_Data %x\n", ioa_Data);
+        unsigned int ioa_Length = m68k_read_memory_32(a1+38);
+        trace(TRACE_TRAPS, "***** BeginIO ioa_Length %x\n", ioa_Length);
+        unsigned int ioa_Period = m68k_read_memory_16(a1+42);
+        trace(TRACE_TRAPS, "***** BeginIO ioa_Period %x\n", ioa_Period);
+        unsigned int ioa_Volume = m68k_read_memory_16(a1+44);
+        trace(TRACE_TRAPS, "***** BeginIO ioa_Volume %x\n", ioa_Volume);
+        unsigned int ioa_Cycles = m68k_read_memory_16(a1+46);
+        trace(TRACE_TRAPS, "***** BeginIO ioa_Cycles %x\n", ioa_Cycles);
+        if (n->trace_level >= TRACE_FULL) {
+            for (int i=0; i<ioa_Length; i++) {
+                fprintf(stderr, "***** BeginIO ioa_Data %d %x\n", i, m68k_read_memory_8(ioa_Data+i));
+            }
+        }
+        if (io_Command == 32) {//ADCMD_ALLOCATE
+            trace(TRACE_TRAPS, "***** BeginIO ADCMD_ALLOCATE\n");
+            m68k_write_memory_8(a1+31, 0);
+            m68k_write_memory_32(a1+24, 0x8/*0xc*/);//io_Unit
+            m68k_write_memory_16(a1+32, 0xaaaa);//ioa_AllocKey
+        } else if (io_Command == 3) {//CMD_WRITE
+            trace(TRACE_TRAPS, "***** BeginIO CMD_WRITE\n");
+            n->sample_count += ioa_Length;
+            if (n->put_samples) {
+                n->put_samples(n, n->ram+ioa_Data, ioa_Length);
+            }
+            if (n->pulling) {
+                pull_samples(n, n->ram+ioa_Data, ioa_Length);
+            }
+        }
+    } else if (arg == 0xfe26) { // WaitIO
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        trace(TRACE_TRAPS, "***** WaitIO %x\n", a1);
+        m68k_set_reg(M68K_REG_D0, 0);
+    } else if (arg == 0xff2e) { // FreeMem
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
+        trace(TRACE_TRAPS, "***** FreeMem memoryBlock %x byteSize %x\n", a1, d0);
+        if (n->allocmark && (a1 >= n->allocmark)) {
+            n->alloc_outstanding--;
+        }
+    } else if (arg == 0xfed4) { // SetTaskPri
+        unsigned int a1 = m68k_get_reg(0, M68K_REG_A1);
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
+        trace(TRACE_TRAPS, "***** SetTaskPri task %x priority %x\n", a1, d0);
+    } else if (arg == 0xfeb0) { // FreeSignal
+        unsigned int d0 = m68k_get_reg(0, M68K_REG_D0);
+        trace(TRACE_TRAPS, "***** FreeSignal signalNum %x\n", d0);
+    } else {
+        fail(n, "unhandled library call %x at %x", arg, pc);
+    }
+}
+
+static int jump_table_contains(unsigned int base, int number_of_lvos, unsigned int pc)
+{
+    if (!base || (pc >= base) || (pc < base-number_of_lvos*6)) {
+        return 0;
+    }
+    return ((base-pc) % 6 == 0);
+}
+
+static int illegal_instruction_callback(int opcode)
+{
+    struct narrator *n = current_narrator();
+    unsigned int pc = m68k_get_reg(0, M68K_REG_PPC);
+    if (opcode == TRAP_OPCODE) {
+        if (pc == n->stoppc) {
+            trace(TRACE_TRAPS, "***** Stop\n");
+            fail(n, "the device stopped");
+            return 1;
+        }
+        if (jump_table_contains(_execbase, NUMBER_OF_EXEC_LVOS, pc)) {
+            library_call(n, pc, (pc-_execbase)&0xffff);
+            return 1;
+        }
+        if (jump_table_contains(_audiodevbase, NUMBER_OF_AUDIO_LVOS, pc)) {
+            library_call(n, pc, (pc-_audiodevbase)&0xffff);
+            return 1;
+        }
+    }
+    fail(n, "illegal instruction %x at %x", opcode, pc);
+    return 1;
+}
+
+// load the device into the instance, or restore it from the snapshot,
+// on the calling thread, returns 0 with the reason in n->error if it cannot
+int narrator_init(struct narrator *n)
+{
+    jmp_buf init_jmp;
+    volatile int cpu_initialised = 0;
+    if (setjmp(init_jmp)) {
+        if (cpu_initialised) {
+            // the context owns what Musashi allocated, see narrator_close()
+            m68k_get_context(n->cpu_context);
+        }
+        n->init_jmp = 0;
+        n->finished = 1;
+        return 0;
+    }
+    n->init_jmp = &init_jmp;
+    n->memmap.trace_writes = (n->trace_level >= TRACE_FULL);
+    // the callbacks find the instance through the cpu, m68k_init() keeps it
+    memmap_set_current(&n->memmap);
+    load_library(n);
+
+    m68k_init();
+    cpu_initialised = 1;
+    m68k_set_illg_instr_callback(illegal_instruction_callback);
+#if M68K_INSTRUCTION_HOOK
+    m68k_set_instr_hook_callback(instr_hook_callback);
+#endif
+    // write tracing needs every write to go through the memory map
+    if (!n->memmap.trace_writes) {
+        m68k_set_direct_ram(n->ram, MAX_RAM);
+    }
+    m68k_set_cpu_type(M68K_CPU_TYPE_68000);
+    m68k_pulse_reset();
+
+    if (!n->snapshot_path || !load_snapshot(n)) {
+        process_hunks(n);
+        process_library(n);
+    }
+    if ((n->engine != M68K_JIT_OFF) && !m68k_set_jit(n->engine)) {
+        if (n->memmap.trace_writes) {
+            fail(n, "the jit cannot trace memory writes");
+        }
+        // not built in, not an x86-64 host, or the system refused to make
+        // the code buffer executable
+        fail(n, "the jit is not available on this build or system");
+    }
+    m68k_get_context(n->cpu_context);
+    n->init_jmp = 0;
+    return 1;
+}
+
+// run the instance on the calling thread, the cpu state is switched in and out
+// so that any number of instances can share a thread
+void narrator_execute(struct narrator *n, int num_cycles)
+{
+    n->running = 1;
+    n->cycle_count += m68k_execute_ctx(n->cpu_context, num_cycles);
+    n->running = 0;
+}
+
+// for an instance without get_input, start speaking one utterance and return
+// at once, without running the device, the samples are then taken with
+// narrator_pull(), phonemes has to stay valid as for narrator_speak()
+void narrator_begin(struct narrator *n, char *phonemes)
+{
+    n->pending = phonemes;
+    n->pull_utterances = n->utterances;
+    n->pull_pos = 0;
+    n->pull_len = 0;
+    n->pulling = 1;
+}
+
+// run the device only until there are len samples of the utterance that
+// narrator_begin() started, or it has been replied to, and copy them to buf,
+// returns the number of samples, which is less than len only at the end of
+// the utterance, and 0 after that
+unsigned int narrator_pull(struct narrator *n, unsigned char *buf, unsigned int len)
+{
+    n->pull_want = len;
+    while (n->pulling && (n->pull_len - n->pull_pos < len)) {
+        if ((n->utterances != n->pull_utterances) || n->finished) {
+            n->pulling = 0;
+            break;
+        }
+        narrator_execute(n, 100000);
+    }
+    unsigned int avail = n->pull_len - n->pull_pos;
+    if (len > avail) {
+        len = avail;
+    }
+    memcpy(buf, n->pullbuf+n->pull_pos, len);
+    n->pull_pos += len;
+    return len;
+}
+
+// for an instance without get_input, speak one utterance and return when the
+// device has replied to it, phonemes has to stay valid until then and is read
+// up to NARRATOR_INPUT_BUFSIZE bytes even without a NUL, so it can be the
+// output buffer of another emulator
+void narrator_speak(struct narrator *n, char *phonemes)
+{
+    unsigned int utterances = n->utterances;
+    n->pending = phonemes;
+    while ((n->utterances == utterances) && !n->finished) {
+        narrator_execute(n, 100000);
+    }
+}
+
+// the cycles so far, also from a hook in the middle of narrator_execute()
+unsigned long long narrator_cycles(struct narrator *n)
+{
+    return n->cycle_count + ((n->running) ? m68k_cycles_run() : 0);
+}
+
+void narrator_default_params(struct narrator_params *params)
+{
+    params->pitch = 110;
+    params->rate = 150;
+    params->volume = 64;
+    params->sampfreq = 22200;
+    params->sex = 0;
+    params->mode = 0;
+}
+
+// returns 0 with the reason in error if a parameter is out of range
+int narrator_check_params(const struct narrator_params *params, char *error, unsigned int error_size)
+{
+    if ((params->pitch < 65) || (params->pitch > 320)) {
+        snprintf(error, error_size, "pitch out of range (65-320)");
+    } else if ((params->rate < 40) || (params->rate > 400)) {
+        snprintf(error, error_size, "rate out of range (40-400)");
+    } else if ((params->volume < 0) || (params->volume > 64)) {
+        snprintf(error, error_size, "volume out of range (0-64)");
+    } else if ((params->sampfreq < 5000) || (params->sampfreq > 28000)) {
+        snprintf(error, error_size, "sampling_frequency out of range (5000-28000)");
+    } else if ((params->sex < 0) || (params->sex > 1)) {
+        snprintf(error, error_size, "invalid sex (0-1)");
+    } else if ((params->mode < 0) || (params->mode > 1)) {
+        snprintf(error, error_size, "invalid mode (0-1)");
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+// before narrator_init(), the parameters are not checked
+void narrator_set_params(struct narrator *n, const struct narrator_params *params)
+{
+    n->pitch = params->pitch;
+    n->rate = params->rate;
+    n->volume = params->volume;
+    n->sampfreq = params->sampfreq;
+    n->sex = params->sex;
+    n->mode = params->mode;
+}
+
+// a new instance with the device loaded and waiting for the first utterance,
+// params can be 0 for the defaults, returns 0 with the reason in error if the
+// device cannot be loaded
+struct narrator *narrator_open(const char *device_path, const struct narrator_params *params, char *error, unsigned int error_size)
+{
+    struct narrator_params defaults;
+    if (!params) {
+        narrator_default_params(&defaults);
+        params = &defaults;
+    }
+    if (!narrator_check_params(params, error, error_size)) {
+        return 0;
+    }
+    struct narrator *n = narrator_new();
+    if (!n) {
+        snprintf(error, error_size, "unable to allocate narrator");
+        return 0;
+    }
+    n->device_path = device_path;
+    narrator_set_params(n, params);
+    if (narrator_init(n)) {
+        while (!n->waiting && !n->finished) {
+            narrator_execute(n, 100000);
+        }
+    }
+    if (n->error[0]) {
+        snprintf(error, error_size, "%s", n->error);
+        narrator_close(n);
+        return 0;
+    }
+    return n;
+}
+
+// CMD_WRITE of narrator_synthesize()
+static void synthesize_samples(struct narrator *n, unsigned char *buf, unsigned int len)
+{
+    n->out(n->out_user, buf, len);
+}
+
+// speak one utterance, handing all of its samples to out, returns 0 with the
+// reason in n->error if the text does not fit in the input buffer of the
+// device, or if the instance has failed, after which it can only be closed
+int narrator_synthesize(struct narrator *n, const char *phonemes, void (*out)(void *user, const unsigned char *samples, unsigned int len), void *user)
+{
+    if (n->finished) {
+        return 0;
+    }
+    n->error[0] = 0;
+    if (strnlen(phonemes, INPUT_BUFSIZE) >= INPUT_BUFSIZE) {
+        snprintf(n->error, sizeof(n->error), "phonetic text longer than %d bytes", INPUT_BUFSIZE-1);
+        return 0;
+    }
+    n->out = out;
+    n->out_user = user;
+    n->put_samples = synthesize_samples;
+    narrator_speak(n, (char *)phonemes);
+    n->put_samples = 0;
+    n->out = 0;
+    n->out_user = 0;
+    return !n->finished;
+}
+
+// free everything the instance has, on any thread, without touching the cpu
+// of the calling thread
+void narrator_close(struct narrator *n)
+{
+    m68k_free_context(n->cpu_context);
+    munmap(n->ram, MAX_RAM);
+    free(n->cpu_context);
+    free(n->outbuf);
+    free(n->pullbuf);
+    free(n);
+}
@@ -0,0 +1,177 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef NARRATOR_DEVICE_H
+#define NARRATOR_DEVICE_H
+
+#include "memmap.h"
+
+/*
+ the emulated narrator.device, loaded from its hunk file and driven through
+ fake exec.library and audio.device calls
+
+ the front end fills in the file paths, the speech parameters and the hooks
+ of a new instance, and then runs it with narrator_execute(), any number of
+ instances can run in the same process, each on one thread at a time
+
+ without hooks, narrator_speak() speaks one utterance, or narrator_begin()
+ starts one and narrator_pull() runs the device just long enough for the next
+ chunk of samples, so that playback can start before the utterance is done
+ */
+
+#define NARRATOR_INPUT_BUFSIZE 0x1000
+#define NARRATOR_LIBRARY_BUFSIZE 100000
+#define NARRATOR_MAX_HUNKS 8
+
+struct narrator {
+    unsigned char *ram;
+    struct memmap memmap;
+    void *cpu_context;
+
+    const char *device_path;
+    char *snapshot_path; //0 for none
+    int snapshot_done; //restored from or saved to snapshot_path already
+    int engine; //M68K_JIT_OFF, M68K_JIT_ON or M68K_JIT_VERIFY, see m68k_set_jit()
+    int trace_level;
+
+    int pitch; //pitch
+    int rate; //speaking rate (wpm)
+    int volume; //volume
+    int sampfreq; //sampling frequency (Hz)
+    int sex; //sex 0=male 1=female
+    int mode; //mode 0=naturalf0 1=roboticf0 2=manualf0
+
+    // called at every GetMsg, sets inputptr to the next utterance, or returns
+    // 0 at the end of input, which finishes the instance, without it the
+    // device waits at GetMsg for narrator_speak()
+    int (*get_input)(struct narrator *n);
+    // the samples of every CMD_WRITE
+    void (*put_samples)(struct narrator *n, unsigned char *buf, unsigned int len);
+    // ReplyMsg, all the samples of the utterance have been put
+    void (*reply)(struct narrator *n);
+    void *user; //for the front end
+
+    char *inputptr;
+    char *pending; //narrator_speak(), the utterance for the next GetMsg
+    char inputbuf[NARRATOR_INPUT_BUFSIZE];
+    unsigned int utterance_count; //number of the current utterance, the front end may renumber it
+    unsigned int utterances; //utterances finished by this instance
+    int finished; //no more input, or the instance failed
+    int running; //inside m68k_execute
+    int waiting; //at GetMsg with nothing to speak
+    char error[256]; //why the instance failed, or why narrator_synthesize() returned 0
+    void *init_jmp; //inside narrator_init()
+
+    // narrator_synthesize()
+    void (*out)(void *user, const unsigned char *samples, unsigned int len);
+    void *out_user;
+
+    // framed output, the samples of the current utterance
+    unsigned char *outbuf;
+    unsigned int outbuf_len;
+    unsigned int outbuf_size;
+
+    // narrator_pull(), the samples of the utterance that have not been taken
+    unsigned char *pullbuf;
+    unsigned int pull_pos;
+    unsigned int pull_len;
+    unsigned int pull_size;
+    unsigned int pull_want; //narrator_execute() returns as soon as this many are there
+    unsigned int pull_utterances; //utterances when narrator_begin() was called
+    int pulling;
+
+    unsigned char library_buf[NARRATOR_LIBRARY_BUFSIZE];
+    int library_size;
+    int library_pos;
+    unsigned int library_hunk_base[NARRATOR_MAX_HUNKS];
+
+    unsigned int allocmem;
+    int allocsignal;
+    unsigned int addtask;
+    unsigned int makelibrary;
+    unsigned int stoppc;
+    unsigned int allocmark;
+    int allocsignalmark;
+    int alloc_outstanding;
+
+    unsigned long long instruction_count;
+    unsigned long long cycle_count;
+    unsigned long long sample_count; //samples written by CMD_WRITE
+};
+
+struct narrator *narrator_new();
+int narrator_init(struct narrator *n);
+void narrator_execute(struct narrator *n, int num_cycles);
+void narrator_speak(struct narrator *n, char *phonemes);
+void narrator_begin(struct narrator *n, char *phonemes);
+unsigned int narrator_pull(struct narrator *n, unsigned char *buf, unsigned int len);
+unsigned long long narrator_cycles(struct narrator *n);
+void narrator_print_ram_usage(struct narrator *n);
+
+/*
+ the library API, for linking the device into another program
+
+ an instance is opened once, which loads the device and runs it up to the
+ point where it waits for the first utterance, and then speaks any number of
+ utterances, it can be used from any thread, but from one at a time, every
+ call switches the cpu context of the instance into the Musashi cpu of the
+ calling thread and the callbacks find the instance through it, so instances
+ keep their own state, except for the snapshot file, which each instance that
+ has one saves on its own and replaces atomically, errors are kept in
+ n->error, the functions never exit or print anything but traces (the
+ translator_library of 'translator' and 'speak' is not part of it, and still
+ exits on errors like the front ends), and the samples of every CMD_WRITE
+ are handed to the callback straight from the ram of the emulator, to be
+ copied into buffers of the caller, or the caller pulls them into its own
+ buffers with narrator_begin() and narrator_pull()
+
+   struct narrator_params params;
+   narrator_default_params(&params);
+   params.rate = 180;
+   char error[256];
+   struct narrator *n = narrator_open("narrator.device", &params, error, sizeof(error));
+   if (!n) ... error
+   if (!narrator_synthesize(n, "/HEH4LOW WER4LD.", play, player)) ... n->error
+   narrator_close(n);
+ */
+
+struct narrator_params {
+    int pitch; //65-320
+    int rate; //40-400 (wpm)
+    int volume; //0-64
+    int sampfreq; //5000-28000 (Hz)
+    int sex; //0=male 1=female
+    int mode; //0=natural 1=robotic
+};
+
+void narrator_default_params(struct narrator_params *params);
+int narrator_check_params(const struct narrator_params *params, char *error, unsigned int error_size);
+void narrator_set_params(struct narrator *n, const struct narrator_params *params);
+struct narrator *narrator_open(const char *device_path, const struct narrator_params *params, char *error, unsigned int error_size);
+int narrator_synthesize(struct narrator *n, const char *phonemes, void (*out)(void *user, const unsigned char *samples, unsigned int len), void *user);
+void narrator_close(struct narrator *n);
+
+#endif /* NARRATOR_DEVICE_H */
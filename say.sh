@@ -6,5 +6,5 @@ if [ "x$1" == "x" ]; then
 fi
 TEXT="$1"
 
-./translator "$TEXT" 2>/dev/null | ./narrator - 2>/dev/null | aplay -f S8 -r 22200
+./speak "$TEXT" 2>/dev/null | aplay -f S8 -r 22200
 
@@ -0,0 +1,362 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "m68k.h"
+#include "translator_library.h"
+#include "narrator_device.h"
+#include "frontend.h"
+
+/*
+ English text to PCM samples in one process, the translator.library and the
+ narrator.device each run in an emulator of their own, taking turns on the
+ main thread, and the narrator reads the phonetic text straight from the
+ output buffer in the ram of the translator
+ */
+
+static int _trace_level = TRACE_OFF;
+static struct timespec _start_time;
+
+static struct translator *_translator = 0;
+static struct narrator *_narrator = 0;
+
+// the samples of a single text are pulled from the narrator a chunk at a time
+// and written at once, so that a player can start after the first chunk
+#define PULL_SAMPLES 1024
+
+static struct timespec _first_sample_time;
+static int _first_sample_done = 0;
+
+/*
+ -i, a pipeline of two threads for text with many sentences, the translator
+ thread translates one sentence after the other and puts the phonetic text in
+ a queue, and the main thread speaks it from there, so that the next sentence
+ is translated while the narrator is still speaking this one
+
+ the queue is a ring of QUEUE_SLOTS slots with one producer and one consumer,
+ each index is only changed by its own thread, so there is no lock, and the
+ semaphores count the free and the used slots, so that a side that has to
+ wait sleeps instead of spinning
+ */
+
+#define QUEUE_SLOTS 16
+
+struct slot {
+    int len; //-1 at the end of the text
+    char phonemes[NARRATOR_INPUT_BUFSIZE];
+};
+
+static char *_text_path = 0;
+static char *_text = 0;
+static unsigned int _number_of_sentences = 0;
+
+static struct slot _queue[QUEUE_SLOTS];
+static unsigned int _queue_head = 0; //next slot to put, translator thread
+static unsigned int _queue_tail = 0; //next slot to take, main thread
+static sem_t _queue_free;
+static sem_t _queue_used;
+
+// samples from CMD_WRITE
+void write_samples(struct narrator *n, unsigned char *buf, unsigned int len)
+{
+    write_all(1, buf, len);
+}
+
+void wait_semaphore(sem_t *sem)
+{
+    while (sem_wait(sem)) {
+        if (errno != EINTR) {
+            fprintf(stderr, "unable to wait for the queue\n");
+            exit(1);
+        }
+    }
+}
+
+// translator thread, len is -1 at the end of the text
+void queue_put(char *phonemes, int len)
+{
+    wait_semaphore(&_queue_free);
+    struct slot *slot = &_queue[_queue_head % QUEUE_SLOTS];
+    slot->len = len;
+    if (len > 0) {
+        memcpy(slot->phonemes, phonemes, len);
+    }
+    _queue_head++;
+    sem_post(&_queue_used);
+}
+
+// main thread, the slot stays valid until queue_release()
+struct slot *queue_take()
+{
+    wait_semaphore(&_queue_used);
+    return &_queue[_queue_tail % QUEUE_SLOTS];
+}
+
+void queue_release()
+{
+    _queue_tail++;
+    sem_post(&_queue_free);
+}
+
+// called by translator_split_text() for every sentence, on the translator thread
+void translate_sentence(char *str, int len)
+{
+    translator_begin(_translator, str, len);
+    while (translator_next(_translator)) {
+        char *output = translator_output(_translator);
+        queue_put(output, strnlen(output, TRANSLATOR_OUTPUT_BUFSIZE));
+    }
+    _number_of_sentences++;
+}
+
+void *translator_thread(void *arg)
+{
+    translator_init(_translator);
+    translator_split_text(_text, translate_sentence);
+    queue_put(0, -1);
+    return 0;
+}
+
+// GetMsg, the phonetic text of the next sentence from the queue
+int get_input(struct narrator *n)
+{
+    struct slot *slot = queue_take();
+    if (slot->len < 0) {
+        queue_release();
+        return 0;
+    }
+    memcpy(n->inputbuf, slot->phonemes, slot->len);
+    if (slot->len < NARRATOR_INPUT_BUFSIZE) {
+        n->inputbuf[slot->len] = 0;
+    }
+    n->inputptr = n->inputbuf;
+    queue_release();
+    return 1;
+}
+
+// -i, translate on a thread of its own and speak on this one
+void run_pipeline()
+{
+    _text = translator_read_text(_text_path);
+    if (sem_init(&_queue_free, 0, QUEUE_SLOTS) || sem_init(&_queue_used, 0, 0)) {
+        fprintf(stderr, "unable to create the queue\n");
+        exit(1);
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, 0, translator_thread, 0)) {
+        fprintf(stderr, "unable to create the translator thread\n");
+        exit(1);
+    }
+    _narrator->get_input = get_input;
+    narrator_init(_narrator);
+    check_narrator(_narrator);
+    while (!_narrator->finished) {
+        narrator_execute(_narrator, 100000);
+    }
+    check_narrator(_narrator);
+    pthread_join(thread, 0);
+}
+
+void print_statistics()
+{
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double seconds = (end_time.tv_sec - _start_time.tv_sec) + (end_time.tv_nsec - _start_time.tv_nsec) / 1e9;
+#if M68K_INSTRUCTION_BUDGET
+    // m68k_execute() counts instructions instead of cycles
+    fprintf(stderr, "instructions translator %llu narrator %llu seconds %.3f\n", _translator->cycle_count, narrator_cycles(_narrator), seconds);
+#else
+    fprintf(stderr, "cycles translator %llu narrator %llu seconds %.3f\n", _translator->cycle_count, narrator_cycles(_narrator), seconds);
+#endif
+    translator_print_ram_usage(_translator);
+    narrator_print_ram_usage(_narrator);
+    fprintf(stderr, "utterances %u\n", _narrator->utterances);
+    if (_first_sample_done) {
+        double first = (_first_sample_time.tv_sec - _start_time.tv_sec) + (_first_sample_time.tv_nsec - _start_time.tv_nsec) / 1e9;
+        fprintf(stderr, "first sample after %.3f seconds\n", first);
+    }
+    if (_text_path) {
+        fprintf(stderr, "sentences %u sentences/sec %.2f\n", _number_of_sentences, (seconds > 0) ? _number_of_sentences / seconds : 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char *text = 0;
+    _translator = translator_new();
+    _narrator = new_narrator();
+    struct narrator *n = _narrator;
+    struct narrator_params params;
+    narrator_default_params(&params);
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-l")) {
+            if (i+1 < argc) {
+                _translator->library_path = argv[i+1];
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting path for -l\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-d")) {
+            if (i+1 < argc) {
+                n->device_path = argv[i+1];
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting path for -d\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-c")) {
+            if (i+1 < argc) {
+                n->snapshot_path = argv[i+1];
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting path for -c\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-e")) {
+            if (i+1 < argc) {
+                long val = strtol(argv[i+1], 0, 10);
+                if ((val < M68K_JIT_OFF) || (val > M68K_JIT_VERIFY)) {
+                    fprintf(stderr, "error, invalid engine (0-2)\n");
+                    exit(1);
+                }
+                n->engine = val;
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting engine for -e\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-i")) {
+            if (i+1 < argc) {
+                _text_path = argv[i+1];
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting path for -i\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-t")) {
+            if (i+1 < argc) {
+                long val = strtol(argv[i+1], 0, 10);
+                if ((val < TRACE_OFF) || (val > TRACE_FULL)) {
+                    fprintf(stderr, "error, invalid trace level (0-2)\n");
+                    exit(1);
+                }
+                _trace_level = val;
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting trace level for -t\n");
+                exit(1);
+            }
+        } else if (parse_speech_option(&params, argc, argv, &i)) {
+        } else {
+            text = argv[i];
+        }
+    }
+
+    if (!text && !_text_path) {
+        fprintf(stderr, "Usage: %s [options] <text>\n", argv[0]);
+        fprintf(stderr, "       %s [options] -i <text_file|->\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "-c snapshot_file (created after the first init of the narrator.device, then used to skip init)\n");
+        fprintf(stderr, "-d narrator_device_file\n");
+        fprintf(stderr, "-e engine (0=interpreter 1=jit 2=jit checked against the interpreter)\n");
+        fprintf(stderr, "-f sampling_frequency (5000-28000)\n");
+        fprintf(stderr, "-i text_file, speak every sentence of the file (or stdin for -), translating the next one meanwhile\n");
+        fprintf(stderr, "-l translator_library_file\n");
+        fprintf(stderr, "-m mode (0=natural 1=robotic)\n");
+        fprintf(stderr, "-p pitch (65-320)\n");
+        fprintf(stderr, "-r rate (40-400)\n");
+        fprintf(stderr, "-s sex (0=male 1=female)\n");
+        fprintf(stderr, "-t trace level (0=off 1=traps 2=every instruction)\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Examples:\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "%s \"Hello world.\"\n", argv[0]);
+        fprintf(stderr, "%s -p 110 -r 150 -f 22200 -s 1 -m 1 \"Hello world.\"\n", argv[0]);
+        fprintf(stderr, "%s -l translator.library~1.3.3 -d narrator.device~1.2 \"Hello world.\"\n", argv[0]);
+        fprintf(stderr, "%s -c narrator.snapshot \"Hello world.\"\n", argv[0]);
+        fprintf(stderr, "%s -i story.txt\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "PCM samples will be written to stdout.\n");
+        fprintf(stderr, "The format is S8 (signed 8-bit) at 22200 Hz\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "If using Linux, play using ALSA: aplay -f S8 -r 22200\n");
+        exit(1);
+    }
+
+    set_speech_params(n, &params);
+
+    clock_gettime(CLOCK_MONOTONIC, &_start_time);
+    if (_trace_level >= TRACE_TRAPS) {
+        atexit(print_statistics);
+    }
+#if !M68K_INSTRUCTION_HOOK
+    if (_trace_level >= TRACE_FULL) {
+        fprintf(stderr, "instruction trace needs Musashi built with M68K_INSTRUCTION_HOOK\n");
+    }
+#endif
+
+    _translator->trace_level = _trace_level;
+    n->trace_level = _trace_level;
+    if (_text_path) {
+        n->put_samples = write_samples;
+        run_pipeline();
+        exit(0);
+    }
+    translator_init(_translator);
+    narrator_init(n);
+    check_narrator(n);
+
+    // phonetic text that does not fit in the output buffer of the translator
+    // is spoken as several utterances
+    translator_begin(_translator, text, strlen(text));
+    while (translator_next(_translator)) {
+        unsigned char buf[PULL_SAMPLES];
+        unsigned int len;
+        narrator_begin(n, translator_output(_translator));
+        while ((len = narrator_pull(n, buf, sizeof(buf))) > 0) {
+            if (!_first_sample_done) {
+                clock_gettime(CLOCK_MONOTONIC, &_first_sample_time);
+                _first_sample_done = 1;
+            }
+            write_all(1, buf, len);
+        }
+        check_narrator(n);
+    }
+
+    exit(0);
+}
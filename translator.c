@@ -24,309 +24,365 @@
  */
 
 #include <stdint.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "m68k.h"
+#include "translator_library.h"
 
-static unsigned char *_library_path = "translator.library";
+static int _trace_level = TRACE_OFF;
+#define trace(level, ...) do { if (_trace_level >= (level)) { fprintf(stderr, __VA_ARGS__); } } while (0)
 
-#define LIBRARY_BUFSIZE 100000
-static unsigned char _library_buf[LIBRARY_BUFSIZE];
-static int _library_size = 0;
+static struct timespec _start_time;
 
-#define MAX_RAM (1024*1024)
-static unsigned char _ram[MAX_RAM];
+static struct translator *_translator = 0;
 
-static unsigned int _librarybase = 0x4000;
-static unsigned int _inputbase = 0x5000;
-static unsigned int _outputbase = 0x6000;
-static unsigned int _stackpointer = 0xf000;
-static unsigned int _mainbase = 0x7000;
+// -f, bulk mode, every sentence of the file is translated with the library
+// that is already in ram
+static char *_bulk_path = 0;
+static unsigned int _number_of_sentences = 0;
 
-#define INPUT_BUFSIZE 0x1000
-#define OUTPUT_BUFSIZE 0x1000
+/*
+ translation cache, -c, the phonetic text of everything translated before,
+ shared by every run that uses the same file
 
-void load_library()
-{
-    fprintf(stderr, "opening '%s'\n", _library_path);
-    FILE *fp = fopen(_library_path, "rb");
-    if (!fp) {
-        fprintf(stderr, "unable to open '%s'\n", _library_path);
-        exit(1);
-    }
-    int result = fread(_library_buf, 1, LIBRARY_BUFSIZE, fp);
-    fprintf(stderr, "fread %d (0x%x)\n", result, result);
-    _library_size = result;
-    fclose(fp);
-}
+ struct cache_header
+ struct cache_entry[CACHE_ENTRIES]
+
+ the file is mapped and changed in place under flock(), an entry is found by
+ the hash of the library file and the normalized text in a set of CACHE_WAYS
+ entries, and when the set is full the least recently used one is replaced,
+ so the file never grows beyond CACHE_ENTRIES entries
+ */
 
-void copy_library_to_ram()
+#define CACHE_MAGIC "TRANCACH"
+#define CACHE_VERSION 1
+#define CACHE_ENTRIES 16384
+#define CACHE_WAYS 8
+#define CACHE_DATA_SIZE 492 //text and phonetic text, both NUL terminated
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entries;
+    uint32_t entry_size;
+    uint32_t reserved;
+    uint64_t clock; //incremented on every use, for the least recently used
+    uint64_t hits; //over the lifetime of the file
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+struct cache_entry {
+    uint64_t hash; //0 when unused
+    uint64_t last_used; //0 when unused
+    uint16_t text_len;
+    uint16_t phonemes_len;
+    char data[CACHE_DATA_SIZE];
+};
+
+static char *_cache_path = 0;
+static int _cache_fd = -1;
+static struct cache_header *_cache = 0;
+static struct cache_entry *_cache_entries = 0;
+static uint64_t _library_hash = 0;
+static unsigned int _cache_hits = 0; //in this run
+static unsigned int _cache_misses = 0;
+static unsigned int _cache_evictions = 0;
+static char *_cache_text = 0; //the text of a single translation, normalized
+static int _cache_text_len = 0;
+
+// FNV-1a
+uint64_t hash_bytes(uint64_t hash, const void *buf, int len)
 {
-    // hardcoded, should parse the hunks
-    for (int i=0x24; i<_library_size; i++) {
-        _ram[i-0x24] = _library_buf[i];
+    const unsigned char *p = buf;
+    for (int i=0; i<len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
     }
+    return hash;
 }
 
-void process_library_with_romtag(char *str)
+// runs of whitespace become a single space, none at the start or the end,
+// dst needs as much room as src
+int normalize_text(char *dst, char *src)
 {
-    fprintf(stderr, "rt_MatchWord 0x4afc\n");
-    fprintf(stderr, "rt_MatchTag 0x%x\n", m68k_read_memory_32(2));
-    fprintf(stderr, "rt_EndSkip 0x%x\n", m68k_read_memory_32(6));
-    unsigned int rt_Flags = m68k_read_memory_8(10);
-    fprintf(stderr, "rt_Flags 0x%x\n", rt_Flags);
-    unsigned int rtf_AutoInit = 0;
-    if (rt_Flags & (1<<7)) {
-        rtf_AutoInit = 1;
-        fprintf(stderr, "rt_Flags RTF_AUTOINIT\n");
-    }
-    if (rt_Flags & (1<<2)) {
-        fprintf(stderr, "rt_Flags RTF_AFTERDOS\n");
-    }
-    if (rt_Flags & (1<<1)) {
-        fprintf(stderr, "rt_Flags RTF_SINGLETASK\n");
-    }
-    if (rt_Flags & (1<<0)) {
-        fprintf(stderr, "rt_Flags RTF_COLDSTART\n");
-    }
-    fprintf(stderr, "rt_Version 0x%x\n", m68k_read_memory_8(11));
-    fprintf(stderr, "rt_Type 0x%x\n", m68k_read_memory_8(12));
-    fprintf(stderr, "rt_Pri 0x%x\n", m68k_read_memory_8(13));
-    unsigned int rt_Name = m68k_read_memory_32(14);
-    fprintf(stderr, "rt_Name 0x%x '%s'\n", rt_Name, _ram+rt_Name);
-    unsigned int rt_IdString = m68k_read_memory_32(18);
-    fprintf(stderr, "rt_IdString 0x%x '%s'\n", rt_IdString, _ram+rt_IdString);
-    unsigned int rt_Init = m68k_read_memory_32(22);
-    fprintf(stderr, "rt_Init 0x%x\n", rt_Init);
-
-    unsigned int translatefunc = 0;
-    if (rtf_AutoInit) {
-        unsigned int dataSize = m68k_read_memory_32(rt_Init);
-        unsigned int vectors = m68k_read_memory_32(rt_Init+4);
-        unsigned int structure = m68k_read_memory_32(rt_Init+8);
-        unsigned int initFunction = m68k_read_memory_32(rt_Init+12);
-        fprintf(stderr, "rtf_AutoInit dataSize 0x%x\n", dataSize);
-        fprintf(stderr, "rtf_AutoInit vectors 0x%x\n", vectors);
-        fprintf(stderr, "rtf_AutoInit structure 0x%x\n", structure);
-        fprintf(stderr, "rtf_AutoInit initFunction 0x%x\n", initFunction);
-        unsigned int vector = m68k_read_memory_16(vectors);
-        if (vector == 0xffff) {
-            for (int i=0;; i++) {
-                vector = m68k_read_memory_16(vectors+2+i*2);
-                if (vector == 0xffff) {
-                    break;
-                }
-                fprintf(stderr, "vectors i %d vector 0x%x\n", i, vector);
-                vector += vectors;
-                fprintf(stderr, "vectors i %d -> vector 0x%x\n", i, vector);
-                if (i == 4) {
-                    fprintf(stderr, "vectors i %d is Translate function\n", i);
-                    translatefunc = vector;
-                }
+    int len = 0;
+    for (char *p=src; *p; p++) {
+        if (isspace((unsigned char)*p)) {
+            if (len && (dst[len-1] != ' ')) {
+                dst[len++] = ' ';
             }
+        } else {
+            dst[len++] = *p;
         }
-    } else {
-        fprintf(stderr, "no RTF_AUTOINIT flag, currently unimplemented, will not work\n");
     }
-
-    fprintf(stderr, "translatefunc %x\n", translatefunc);
-
-    int len = strlen(str);
-    if (len >= INPUT_BUFSIZE) {
-        len = INPUT_BUFSIZE;
+    while (len && (dst[len-1] == ' ')) {
+        len--;
     }
-    strncpy(_ram + _inputbase, str, len);
-    m68k_set_reg(M68K_REG_A0, _inputbase);
-    m68k_set_reg(M68K_REG_D0, len);
-    m68k_set_reg(M68K_REG_A1, _outputbase);
-    m68k_set_reg(M68K_REG_D1, OUTPUT_BUFSIZE);
-    m68k_set_reg(M68K_REG_SP, _stackpointer);
-
-    m68k_set_reg(M68K_REG_A6, _librarybase);
-
-    m68k_write_memory_16(_mainbase, 0x4eb9); //jsr
-    m68k_write_memory_32(_mainbase+2, translatefunc);
-    m68k_write_memory_32(_mainbase+6, 0x4e722700); //stop $2700
-
-    m68k_set_reg(M68K_REG_PC, _mainbase);
+    dst[len] = 0;
+    return len;
 }
 
-void process_library(char *str)
+// the cache is left off if the file cannot be used
+void open_cache()
 {
-    if ((_ram[0] == 0x4a) && (_ram[1] == 0xfc)) {
-        fprintf(stderr, "ROMTag found\n");
-        process_library_with_romtag(str);
+    _library_hash = hash_bytes(0xcbf29ce484222325ULL, _translator->library_buf, _translator->library_size);
+    size_t size = sizeof(struct cache_header) + CACHE_ENTRIES*sizeof(struct cache_entry);
+    _cache_fd = open(_cache_path, O_RDWR|O_CREAT, 0644);
+    if (_cache_fd < 0) {
+        fprintf(stderr, "unable to open cache '%s'\n", _cache_path);
         return;
     }
-
-    fprintf(stderr, "no ROMTag\n");
-
-    int len = strlen(str);
-    if (len >= INPUT_BUFSIZE) {
-        len = INPUT_BUFSIZE;
+    flock(_cache_fd, LOCK_EX);
+    struct stat st;
+    struct cache_header header;
+    int valid = !fstat(_cache_fd, &st) && (st.st_size == size)
+        && (pread(_cache_fd, &header, sizeof(header), 0) == sizeof(header))
+        && !memcmp(header.magic, CACHE_MAGIC, 8) && (header.version == CACHE_VERSION)
+        && (header.entries == CACHE_ENTRIES) && (header.entry_size == sizeof(struct cache_entry));
+    if (!valid) {
+        // new, or a different format, start over
+        trace(TRACE_TRAPS, "creating cache '%s'\n", _cache_path);
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_MAGIC, 8);
+        header.version = CACHE_VERSION;
+        header.entries = CACHE_ENTRIES;
+        header.entry_size = sizeof(struct cache_entry);
+        if (ftruncate(_cache_fd, 0) || ftruncate(_cache_fd, size)
+            || (pwrite(_cache_fd, &header, sizeof(header), 0) != sizeof(header))) {
+            fprintf(stderr, "unable to create cache '%s'\n", _cache_path);
+            flock(_cache_fd, LOCK_UN);
+            close(_cache_fd);
+            _cache_fd = -1;
+            return;
+        }
     }
-    strncpy(_ram + _inputbase, str, len);
-    m68k_set_reg(M68K_REG_A0, _inputbase);
-    m68k_set_reg(M68K_REG_D0, len);
-    m68k_set_reg(M68K_REG_A1, _outputbase);
-    m68k_set_reg(M68K_REG_D1, OUTPUT_BUFSIZE);
-    m68k_set_reg(M68K_REG_SP, _stackpointer);
-
-    m68k_set_reg(M68K_REG_A6, _librarybase);
-
-    m68k_write_memory_16(_mainbase, 0x4eb9); //jsr
-    m68k_write_memory_32(_mainbase+2, 0x134); //Translate, hardcoded, should get from MakeLibrary
-    m68k_write_memory_32(_mainbase+6, 0x4e722700); //stop $2700
-
-    m68k_set_reg(M68K_REG_PC, _mainbase);
-}
-
-unsigned int m68k_read_memory_8(unsigned int addr)
-{
-    unsigned int val = _ram[addr];
-//fprintf(stderr, "m68k_read_memory_8 %x %x\n", addr, val);
-    return val;
-}
-
-unsigned int m68k_read_memory_16(unsigned int addr)
-{
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p;
-//fprintf(stderr, "m68k_read_memory_16 %x %x\n", addr, val);
-    return val;
-}
-
-unsigned int m68k_read_memory_32(unsigned int addr)
-{
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p;
-//fprintf(stderr, "m68k_read_memory_32 %x %x\n", addr, val);
-    return val;
-}
-
-void m68k_write_memory_8(unsigned int addr, unsigned int val)
-{
-fprintf(stderr, "m68k_write_memory_8 addr %x val %x\n", addr, val);
-    _ram[addr] = val;
+    void *p = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, _cache_fd, 0);
+    flock(_cache_fd, LOCK_UN);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "unable to map cache '%s'\n", _cache_path);
+        close(_cache_fd);
+        _cache_fd = -1;
+        return;
+    }
+    _cache = p;
+    _cache_entries = (struct cache_entry *)(_cache+1);
+    trace(TRACE_TRAPS, "cache '%s' hits %llu misses %llu evictions %llu\n", _cache_path,
+        (unsigned long long)_cache->hits, (unsigned long long)_cache->misses, (unsigned long long)_cache->evictions);
 }
 
-void m68k_write_memory_16(unsigned int addr, unsigned int val)
+uint64_t cache_hash(char *text, int len)
 {
-fprintf(stderr, "m68k_write_memory_16 addr %x val %x\n", addr, val);
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    p[1] = val&0xff;
-    val >>= 8;
-    p[0] = val&0xff;
+    uint64_t hash = hash_bytes(0xcbf29ce484222325ULL, &_library_hash, sizeof(_library_hash));
+    hash = hash_bytes(hash, text, len);
+    return (hash) ? hash : 1;
 }
 
-void m68k_write_memory_32(unsigned int addr, unsigned int val)
+// the first entry of the set for the hash
+struct cache_entry *cache_set(uint64_t hash)
 {
-fprintf(stderr, "m68k_write_memory_32 addr %x val %x\n", addr, val);
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    p[3] = val&0xff;
-    val >>= 8;
-    p[2] = val&0xff;
-    val >>= 8;
-    p[1] = val&0xff;
-    val >>= 8;
-    p[0] = val&0xff;
+    return &_cache_entries[(hash % (CACHE_ENTRIES/CACHE_WAYS)) * CACHE_WAYS];
 }
 
-unsigned int m68k_read_disassembler_8(unsigned int addr)
+// returns the length of the phonetic text copied to buf (CACHE_DATA_SIZE
+// bytes), or -1 if the text is not in the cache
+int cache_lookup(char *text, int len, char *buf)
 {
-    unsigned int val = _ram[addr];
-//fprintf(stderr, "m68k_read_disassembler_8 %x %x\n", addr, val);
-    return val;
+    if (!_cache) {
+        return -1;
+    }
+    uint64_t hash = cache_hash(text, len);
+    struct cache_entry *set = cache_set(hash);
+    int result = -1;
+    flock(_cache_fd, LOCK_EX);
+    for (int i=0; i<CACHE_WAYS; i++) {
+        struct cache_entry *e = &set[i];
+        // the file is shared, so an entry that does not fit, corrupt or
+        // half written, is a miss, with the bound of cache_insert()
+        if ((len >= CACHE_DATA_SIZE) || (e->text_len+1+e->phonemes_len+1 > CACHE_DATA_SIZE)) {
+            continue;
+        }
+        if ((e->hash == hash) && (e->text_len == len) && !memcmp(e->data, text, len)) {
+            e->last_used = ++_cache->clock;
+            result = e->phonemes_len;
+            memcpy(buf, e->data+len+1, result);
+            buf[result] = 0;
+            break;
+        }
+    }
+    if (result < 0) {
+        _cache->misses++;
+        _cache_misses++;
+    } else {
+        _cache->hits++;
+        _cache_hits++;
+    }
+    flock(_cache_fd, LOCK_UN);
+    return result;
 }
 
-unsigned int m68k_read_disassembler_16(unsigned int addr)
+// entries that do not fit in CACHE_DATA_SIZE are not cached
+void cache_insert(char *text, int len, char *phonemes, int phonemes_len)
 {
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p;
-//fprintf(stderr, "m68k_read_disassembler_16 %x %x\n", addr, val);
-    return val;
+    if (!_cache || (len+1+phonemes_len+1 > CACHE_DATA_SIZE)) {
+        return;
+    }
+    uint64_t hash = cache_hash(text, len);
+    struct cache_entry *set = cache_set(hash);
+    flock(_cache_fd, LOCK_EX);
+    struct cache_entry *e = 0;
+    for (int i=0; i<CACHE_WAYS; i++) {
+        if (set[i].hash == hash) {
+            e = &set[i];
+            break;
+        }
+    }
+    // or the least recently used entry, unused ones first
+    if (!e) {
+        e = &set[0];
+        for (int i=1; i<CACHE_WAYS; i++) {
+            if (set[i].last_used < e->last_used) {
+                e = &set[i];
+            }
+        }
+    }
+    if (e->hash && (e->hash != hash)) {
+        _cache->evictions++;
+        _cache_evictions++;
+    }
+    e->hash = hash;
+    e->last_used = ++_cache->clock;
+    e->text_len = len;
+    e->phonemes_len = phonemes_len;
+    memcpy(e->data, text, len);
+    e->data[len] = 0;
+    memcpy(e->data+len+1, phonemes, phonemes_len);
+    e->data[len+1+phonemes_len] = 0;
+    flock(_cache_fd, LOCK_UN);
 }
-
-unsigned int m68k_read_disassembler_32(unsigned int addr)
+void print_statistics()
 {
-    uint8_t *p = (uint8_t *) &_ram[addr];
-    unsigned int val;
-    val = *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p++;
-    val <<= 8;
-    val |= *p;
-//fprintf(stderr, "m68k_read_disassembler_32 %x %x\n", addr, val);
-    return val;
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double seconds = (end_time.tv_sec - _start_time.tv_sec) + (end_time.tv_nsec - _start_time.tv_nsec) / 1e9;
+    unsigned long long cycles = _translator->cycle_count;
+#if M68K_INSTRUCTION_BUDGET
+    // m68k_execute() counts instructions instead of cycles
+    fprintf(stderr, "instructions %llu seconds %.3f instructions/sec %.0f\n", cycles, seconds, (seconds > 0) ? cycles / seconds : 0);
+#else
+    fprintf(stderr, "cycles %llu seconds %.3f cycles/sec %.0f\n", cycles, seconds, (seconds > 0) ? cycles / seconds : 0);
+#endif
+#if M68K_INSTRUCTION_HOOK
+    unsigned long long instructions = _translator->instruction_count;
+    fprintf(stderr, "instructions %llu instructions/sec %.0f\n", instructions, (seconds > 0) ? instructions / seconds : 0);
+#endif
+    translator_print_ram_usage(_translator);
+    if (_cache) {
+        fprintf(stderr, "cache hits %u misses %u evictions %u\n", _cache_hits, _cache_misses, _cache_evictions);
+    }
+    if (_bulk_path) {
+        fprintf(stderr, "sentences %u sentences/sec %.2f\n", _number_of_sentences, (seconds > 0) ? _number_of_sentences / seconds : 0);
+    }
 }
 
-void make_hex(char *buf, unsigned int pc, unsigned int len)
+// translate one sentence and write the phonemes as one line, when they do not
+// fit in the output buffer, Translate returns minus the position in the input
+// where it stopped, and it is called again from there
+void translate_sentence(char *str, int len)
 {
-	char *p = buf;
-    for (int i=0; i<len; i+=2) {
-        if (i > 0) {
-			*p++ = ' ';
+    char phonemes[CACHE_DATA_SIZE];
+    int phonemes_len = cache_lookup(str, len, phonemes);
+    if (phonemes_len >= 0) {
+        printf("%s\n", phonemes);
+        _number_of_sentences++;
+        return;
+    }
+    phonemes_len = 0; //-1 once the phonetic text is too long for the cache
+    int first = 1;
+    translator_begin(_translator, str, len);
+    while (translator_next(_translator)) {
+        char *output = translator_output(_translator);
+        int output_len = strnlen(output, TRANSLATOR_OUTPUT_BUFSIZE);
+        printf("%s%.*s", (first) ? "" : " ", output_len, output);
+        if ((phonemes_len >= 0) && (phonemes_len+1+output_len < CACHE_DATA_SIZE)) {
+            if (!first) {
+                phonemes[phonemes_len++] = ' ';
+            }
+            memcpy(phonemes+phonemes_len, output, output_len);
+            phonemes_len += output_len;
+        } else {
+            phonemes_len = -1;
         }
-		sprintf(p, "%04x", m68k_read_memory_16(pc));
-		pc += 2;
-		p += 4;
-	}
-}
-
-void instr_hook_callback(unsigned int pc)
-{
-	char buf[256];
-	char buf2[256];
-
-    unsigned int sp = m68k_get_reg(0, M68K_REG_SP);
-
-	unsigned int instr_size = m68k_disassemble(buf, pc, M68K_CPU_TYPE_68000);
-	make_hex(buf2, pc, instr_size);
-	fprintf(stderr, "Execute %03x: %-20s: %s (SP %x)\n", pc, buf2, buf, sp);
-    unsigned int instr = m68k_read_memory_16(pc);
-    if (instr == 0x4e72) {
-        fprintf(stderr, "***** Stop\n");
-        printf("%s\n", _ram+_outputbase);
-        exit(0);
+        first = 0;
+    }
+    printf("\n");
+    _number_of_sentences++;
+    if (phonemes_len >= 0) {
+        cache_insert(str, len, phonemes, phonemes_len);
     }
 }
 
 void main(int argc, char **argv)
 {
-    unsigned char *text = 0;
+    char *text = 0;
+    _translator = translator_new();
     for (int i=1; i<argc; i++) {
         if (!strcmp(argv[i], "-l")) {
             if (i+1 < argc) {
-                _library_path = argv[i+1];
+                _translator->library_path = argv[i+1];
                 i++;
             } else {
                 fprintf(stderr, "error, expecting path for -l\n");
                 exit(1);
             }
+        } else if (!strcmp(argv[i], "-c")) {
+            if (i+1 < argc) {
+                _cache_path = argv[i+1];
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting path for -c\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-f")) {
+            if (i+1 < argc) {
+                _bulk_path = argv[i+1];
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting path for -f\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-t")) {
+            if (i+1 < argc) {
+                long val = strtol(argv[i+1], 0, 10);
+                if ((val < TRACE_OFF) || (val > TRACE_FULL)) {
+                    fprintf(stderr, "error, invalid trace level (0-2)\n");
+                    exit(1);
+                }
+                _trace_level = val;
+                i++;
+            } else {
+                fprintf(stderr, "error, expecting trace level for -t\n");
+                exit(1);
+            }
         } else {
             text = argv[i];
         }
     }
 
-    if (!text) {
-        fprintf(stderr, "Usage: %s [-l translator_library_file] <text>\n", argv[0]);
+    if (!text && !_bulk_path) {
+        fprintf(stderr, "Usage: %s [-l translator_library_file] [-c cache_file] [-t trace_level] <text>\n", argv[0]);
+        fprintf(stderr, "       %s [-l translator_library_file] [-c cache_file] [-t trace_level] -f <text_file|->\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Trace levels: 0=off 1=loader 2=every instruction\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Examples:\n");
         fprintf(stderr, "%s \"Hello world.\"\n", argv[0]);
@@ -335,25 +391,59 @@ void main(int argc, char **argv)
         fprintf(stderr, "%s -l translator.library~1.2 \"Hello world.\"\n", argv[0]);
         fprintf(stderr, "%s -l translator.library~1.3.3 \"Hello world.\"\n", argv[0]);
         fprintf(stderr, "%s -l translator.library~2.04 \"Hello world.\"\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "With -f, the whole file (or stdin) is split into sentences, and the phonetic\n");
+        fprintf(stderr, "text of every sentence is written as a line of its own:\n");
+        fprintf(stderr, "%s -f story.txt\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "With -c, translations are kept in the cache file, and text that has been\n");
+        fprintf(stderr, "translated before with the same library is not translated again:\n");
+        fprintf(stderr, "%s -c translator.cache -f story.txt\n", argv[0]);
         exit(1);
     }
 
-    for (int i=0; i<MAX_RAM; i++) {
-        _ram[i] = 0;
+    clock_gettime(CLOCK_MONOTONIC, &_start_time);
+    if (_trace_level >= TRACE_TRAPS) {
+        atexit(print_statistics);
     }
-    load_library();
-    copy_library_to_ram();
-
-    m68k_init();
-    m68k_set_instr_hook_callback(instr_hook_callback);
-    m68k_set_cpu_type(M68K_CPU_TYPE_68000);
-    m68k_pulse_reset();
 
-    process_library(text);
-    for(;;) {
-        m68k_execute(100000);
+    _translator->trace_level = _trace_level;
+    translator_load_library(_translator);
+    if (_cache_path) {
+        open_cache();
+    }
+    if (_cache && !_bulk_path) {
+        // the text as it is looked up is also what is translated
+        _cache_text = malloc(strlen(text)+1);
+        if (!_cache_text) {
+            fprintf(stderr, "unable to allocate text\n");
+            exit(1);
+        }
+        _cache_text_len = normalize_text(_cache_text, text);
+        text = _cache_text;
+        char phonemes[CACHE_DATA_SIZE];
+        if (cache_lookup(_cache_text, _cache_text_len, phonemes) >= 0) {
+            printf("%s\n", phonemes);
+            exit(0);
+        }
     }
 
+#if !M68K_INSTRUCTION_HOOK
+    if (_trace_level >= TRACE_FULL) {
+        fprintf(stderr, "instruction trace needs Musashi built with M68K_INSTRUCTION_HOOK\n");
+    }
+#endif
+    translator_init(_translator);
+    if (_bulk_path) {
+        translator_split_text(translator_read_text(_bulk_path), translate_sentence);
+        exit(0);
+    }
+    int result = translator_translate(_translator, text, strlen(text));
+    char *output = translator_output(_translator);
+    int output_len = strnlen(output, TRANSLATOR_OUTPUT_BUFSIZE);
+    printf("%.*s\n", output_len, output);
+    if (_cache_text && (result == 0)) {
+        cache_insert(_cache_text, _cache_text_len, output, output_len);
+    }
     exit(0);
 }
-
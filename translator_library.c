@@ -0,0 +1,450 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "m68k.h"
+#include "memmap.h"
+#include "translator_library.h"
+
+// every function that traces has the instance in t
+#define trace(level, ...) do { if (t->trace_level >= (level)) { fprintf(stderr, __VA_ARGS__); } } while (0)
+
+#define INPUT_BUFSIZE TRANSLATOR_INPUT_BUFSIZE
+#define OUTPUT_BUFSIZE TRANSLATOR_OUTPUT_BUFSIZE
+#define LIBRARY_BUFSIZE TRANSLATOR_LIBRARY_BUFSIZE
+
+#define MAX_RAM (1024*1024)
+
+static unsigned int _librarybase = 0x4000;
+static unsigned int _inputbase = 0x5000;
+static unsigned int _outputbase = 0x6000;
+static unsigned int _stackpointer = 0xf000;
+static unsigned int _mainbase = 0x7000;
+
+#define TRAP_OPCODE 0x4afc //illegal
+
+struct translator *translator_new()
+{
+    struct translator *t = calloc(1, sizeof(struct translator));
+    if (!t) {
+        fprintf(stderr, "unable to allocate translator\n");
+        exit(1);
+    }
+    // zero filled by the kernel on first use, a page at a time
+    t->ram = mmap(0, MAX_RAM, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (t->ram == MAP_FAILED) {
+        fprintf(stderr, "unable to allocate ram\n");
+        exit(1);
+    }
+    memmap_init(&t->memmap);
+    memmap_map_ram(&t->memmap, 0, MAX_RAM, t->ram);
+    t->memmap.owner = t;
+    t->cpu_context = malloc(m68k_context_size());
+    if (!t->cpu_context) {
+        fprintf(stderr, "unable to allocate cpu context\n");
+        exit(1);
+    }
+    t->library_path = "translator.library";
+    return t;
+}
+
+// only reads the file, so that it can be hashed before the emulator is set up
+void translator_load_library(struct translator *t)
+{
+    trace(TRACE_TRAPS, "opening '%s'\n", t->library_path);
+    FILE *fp = fopen(t->library_path, "rb");
+    if (!fp) {
+        fprintf(stderr, "unable to open '%s'\n", t->library_path);
+        exit(1);
+    }
+    int result = fread(t->library_buf, 1, LIBRARY_BUFSIZE, fp);
+    trace(TRACE_TRAPS, "fread %d (0x%x)\n", result, result);
+    t->library_size = result;
+    fclose(fp);
+}
+
+static void copy_library_to_ram(struct translator *t)
+{
+    // hardcoded, should parse the hunks
+    for (int i=0x24; i<t->library_size; i++) {
+        t->ram[i-0x24] = t->library_buf[i];
+    }
+}
+
+// set up a call of the Translate function, m68k_execute() runs it
+static void call_translate(struct translator *t, char *str, int len)
+{
+    if (len >= INPUT_BUFSIZE) {
+        len = INPUT_BUFSIZE;
+    }
+    strncpy(t->ram + _inputbase, str, len);
+    m68k_set_reg(M68K_REG_A0, _inputbase);
+    m68k_set_reg(M68K_REG_D0, len);
+    m68k_set_reg(M68K_REG_A1, _outputbase);
+    m68k_set_reg(M68K_REG_D1, OUTPUT_BUFSIZE);
+    m68k_set_reg(M68K_REG_SP, _stackpointer);
+
+    m68k_set_reg(M68K_REG_A6, _librarybase);
+
+    m68k_write_memory_16(_mainbase, 0x4eb9); //jsr
+    m68k_write_memory_32(_mainbase+2, t->translatefunc);
+    m68k_write_memory_16(_mainbase+6, TRAP_OPCODE); //stop here, see illegal_instruction_callback()
+
+    m68k_set_reg(M68K_REG_PC, _mainbase);
+}
+
+static void process_library_with_romtag(struct translator *t)
+{
+    trace(TRACE_TRAPS, "rt_MatchWord 0x4afc\n");
+    trace(TRACE_TRAPS, "rt_MatchTag 0x%x\n", m68k_read_memory_32(2));
+    trace(TRACE_TRAPS, "rt_EndSkip 0x%x\n", m68k_read_memory_32(6));
+    unsigned int rt_Flags = m68k_read_memory_8(10);
+    trace(TRACE_TRAPS, "rt_Flags 0x%x\n", rt_Flags);
+    unsigned int rtf_AutoInit = 0;
+    if (rt_Flags & (1<<7)) {
+        rtf_AutoInit = 1;
+        trace(TRACE_TRAPS, "rt_Flags RTF_AUTOINIT\n");
+    }
+    if (rt_Flags & (1<<2)) {
+        trace(TRACE_TRAPS, "rt_Flags RTF_AFTERDOS\n");
+    }
+    if (rt_Flags & (1<<1)) {
+        trace(TRACE_TRAPS, "rt_Flags RTF_SINGLETASK\n");
+    }
+    if (rt_Flags & (1<<0)) {
+        trace(TRACE_TRAPS, "rt_Flags RTF_COLDSTART\n");
+    }
+    trace(TRACE_TRAPS, "rt_Version 0x%x\n", m68k_read_memory_8(11));
+    trace(TRACE_TRAPS, "rt_Type 0x%x\n", m68k_read_memory_8(12));
+    trace(TRACE_TRAPS, "rt_Pri 0x%x\n", m68k_read_memory_8(13));
+    unsigned int rt_Name = m68k_read_memory_32(14);
+    trace(TRACE_TRAPS, "rt_Name 0x%x '%s'\n", rt_Name, t->ram+rt_Name);
+    unsigned int rt_IdString = m68k_read_memory_32(18);
+    trace(TRACE_TRAPS, "rt_IdString 0x%x '%s'\n", rt_IdString, t->ram+rt_IdString);
+    unsigned int rt_Init = m68k_read_memory_32(22);
+    trace(TRACE_TRAPS, "rt_Init 0x%x\n", rt_Init);
+
+    unsigned int translatefunc = 0;
+    if (rtf_AutoInit) {
+        unsigned int dataSize = m68k_read_memory_32(rt_Init);
+        unsigned int vectors = m68k_read_memory_32(rt_Init+4);
+        unsigned int structure = m68k_read_memory_32(rt_Init+8);
+        unsigned int initFunction = m68k_read_memory_32(rt_Init+12);
+        trace(TRACE_TRAPS, "rtf_AutoInit dataSize 0x%x\n", dataSize);
+        trace(TRACE_TRAPS, "rtf_AutoInit vectors 0x%x\n", vectors);
+        trace(TRACE_TRAPS, "rtf_AutoInit structure 0x%x\n", structure);
+        trace(TRACE_TRAPS, "rtf_AutoInit initFunction 0x%x\n", initFunction);
+        unsigned int vector = m68k_read_memory_16(vectors);
+        if (vector == 0xffff) {
+            for (int i=0;; i++) {
+                vector = m68k_read_memory_16(vectors+2+i*2);
+                if (vector == 0xffff) {
+                    break;
+                }
+                trace(TRACE_TRAPS, "vectors i %d vector 0x%x\n", i, vector);
+                vector += vectors;
+                trace(TRACE_TRAPS, "vectors i %d -> vector 0x%x\n", i, vector);
+                if (i == 4) {
+                    trace(TRACE_TRAPS, "vectors i %d is Translate function\n", i);
+                    translatefunc = vector;
+                }
+            }
+        }
+    } else {
+        fprintf(stderr, "no RTF_AUTOINIT flag, currently unimplemented, will not work\n");
+    }
+
+    trace(TRACE_TRAPS, "translatefunc %x\n", translatefunc);
+
+    t->translatefunc = translatefunc;
+}
+
+// find the Translate function
+static void process_library(struct translator *t)
+{
+    if ((t->ram[0] == 0x4a) && (t->ram[1] == 0xfc)) {
+        trace(TRACE_TRAPS, "ROMTag found\n");
+        process_library_with_romtag(t);
+        return;
+    }
+
+    trace(TRACE_TRAPS, "no ROMTag\n");
+
+    t->translatefunc = 0x134; //Translate, hardcoded, should get from MakeLibrary
+}
+
+// how much of the emulated ram the library has actually touched
+void translator_print_ram_usage(struct translator *t)
+{
+    memmap_print_ram_usage(t->ram, MAX_RAM);
+}
+
+// the instance whose cpu context is switched in on this thread
+static struct translator *current_translator()
+{
+    return memmap_get_current()->owner;
+}
+
+#if M68K_INSTRUCTION_HOOK
+static void instr_hook_callback(unsigned int pc)
+{
+    struct translator *t = current_translator();
+    t->instruction_count++;
+    if (t->trace_level >= TRACE_FULL) {
+        memmap_trace_instruction(pc);
+    }
+}
+#endif
+
+static int illegal_instruction_callback(int opcode)
+{
+    struct translator *t = current_translator();
+    unsigned int pc = m68k_get_reg(0, M68K_REG_PPC);
+    if ((opcode == TRAP_OPCODE) && (pc == _mainbase+6)) {
+        trace(TRACE_TRAPS, "***** Stop\n");
+        // m68k_execute returns after this instruction
+        t->done = 1;
+        m68k_end_timeslice();
+        return 1;
+    }
+    fprintf(stderr, "illegal instruction %x at %x\n", opcode, pc);
+    exit(1);
+}
+
+// copy the library into the instance and find the Translate function, on the
+// calling thread
+void translator_init(struct translator *t)
+{
+    if (!t->library_size) {
+        translator_load_library(t);
+    }
+    t->memmap.trace_writes = (t->trace_level >= TRACE_FULL);
+    // the callbacks find the instance through the cpu, m68k_init() keeps it
+    memmap_set_current(&t->memmap);
+    copy_library_to_ram(t);
+
+    m68k_init();
+    m68k_set_illg_instr_callback(illegal_instruction_callback);
+#if M68K_INSTRUCTION_HOOK
+    m68k_set_instr_hook_callback(instr_hook_callback);
+#endif
+    // write tracing needs every write to go through the memory map
+    if (!t->memmap.trace_writes) {
+        m68k_set_direct_ram(t->ram, MAX_RAM);
+    }
+    m68k_set_cpu_type(M68K_CPU_TYPE_68000);
+    m68k_pulse_reset();
+
+    process_library(t);
+    m68k_get_context(t->cpu_context);
+}
+
+// one call of Translate with len bytes of str (at most TRANSLATOR_INPUT_BUFSIZE),
+// returns what it returns, and the phonetic text is at translator_output()
+int translator_translate(struct translator *t, char *str, int len)
+{
+    m68k_set_context(t->cpu_context);
+    call_translate(t, str, len);
+    t->done = 0;
+    while (!t->done) {
+        t->cycle_count += m68k_execute(100000);
+    }
+    int result = m68k_get_reg(0, M68K_REG_D0);
+    m68k_get_context(t->cpu_context);
+    return result;
+}
+
+// the output buffer in the emulated ram, NUL terminated unless the phonetic
+// text fills all TRANSLATOR_OUTPUT_BUFSIZE bytes
+char *translator_output(struct translator *t)
+{
+    return t->ram + _outputbase;
+}
+
+// translate text of any length with translator_next()
+void translator_begin(struct translator *t, char *text, int len)
+{
+    t->text = text;
+    t->text_len = len;
+    t->text_pos = 0;
+}
+
+// translate the next part of the text, returns 0 when all of it has been
+// translated, when the phonetic text does not fit in the output buffer,
+// Translate returns minus the position in the input where it stopped, and it
+// is called again from there, and text longer than the input buffer is split
+// between words if possible
+int translator_next(struct translator *t)
+{
+    char *str = t->text;
+    int len = t->text_len;
+    int pos = t->text_pos;
+    while ((pos < len) && (str[pos] == ' ')) {
+        pos++;
+    }
+    if (pos >= len) {
+        return 0;
+    }
+    int part = len - pos;
+    if (part > INPUT_BUFSIZE) {
+        part = INPUT_BUFSIZE;
+        while ((part > 1) && (str[pos+part] != ' ')) {
+            part--;
+        }
+        if (part == 1) {
+            part = INPUT_BUFSIZE;
+        }
+    }
+    int result = translator_translate(t, str+pos, part);
+    if (result >= 0) {
+        pos += part;
+    } else if ((-result > 0) && (-result <= part)) {
+        pos += -result;
+    } else {
+        fprintf(stderr, "unable to translate '%.*s' (%d)\n", part, str+pos, result);
+        exit(1);
+    }
+    t->text_pos = pos;
+    return 1;
+}
+
+static char *_abbreviations[] = { "Mr", "Mrs", "Ms", "Dr", "St", "Jr", "Sr", "vs", 0 };
+
+// whether the period at the end of the sentence belongs to a title such as Mr.
+static int ends_with_abbreviation(char *sentence, int len)
+{
+    int start = len-1;
+    while ((start > 0) && isalpha((unsigned char)sentence[start-1])) {
+        start--;
+    }
+    for (int i=0; _abbreviations[i]; i++) {
+        int n = strlen(_abbreviations[i]);
+        if ((n == len-1-start) && !strncmp(sentence+start, _abbreviations[i], n)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// a sentence without the spaces at the end, if anything is left
+static void put_sentence(char *str, int len, void (*sentence)(char *str, int len))
+{
+    while ((len > 0) && (str[len-1] == ' ')) {
+        len--;
+    }
+    if (len > 0) {
+        sentence(str, len);
+    }
+}
+
+// split the text into sentences and pass them to sentence_func() in turn,
+// runs of whitespace become a single space, and a sentence ends at a blank
+// line, or after . ! or ? (and any closing quotes or brackets) unless the next
+// word is lowercase or the period belongs to an abbreviation
+void translator_split_text(char *text, void (*sentence_func)(char *str, int len))
+{
+    char *sentence = malloc(strlen(text)+1);
+    if (!sentence) {
+        fprintf(stderr, "unable to allocate sentence\n");
+        exit(1);
+    }
+    int len = 0;
+    int i = 0;
+    while (text[i]) {
+        if (isspace((unsigned char)text[i])) {
+            int newlines = 0;
+            while (isspace((unsigned char)text[i])) {
+                if (text[i] == '\n') {
+                    newlines++;
+                }
+                i++;
+            }
+            if (newlines > 1) {
+                put_sentence(sentence, len, sentence_func);
+                len = 0;
+            } else if (len > 0) {
+                sentence[len++] = ' ';
+            }
+            continue;
+        }
+        sentence[len++] = text[i++];
+        if (strchr(".!?", sentence[len-1]) && !((sentence[len-1] == '.') && ends_with_abbreviation(sentence, len))) {
+            while (text[i] && strchr("\"')]", text[i])) {
+                sentence[len++] = text[i++];
+            }
+            int next = i;
+            while (isspace((unsigned char)text[next])) {
+                next++;
+            }
+            if (((text[i] == 0) || isspace((unsigned char)text[i])) && !islower((unsigned char)text[next])) {
+                put_sentence(sentence, len, sentence_func);
+                len = 0;
+            }
+        }
+    }
+    put_sentence(sentence, len, sentence_func);
+    free(sentence);
+}
+
+// the whole file, or stdin for '-'
+char *translator_read_text(char *path)
+{
+    FILE *fp = (!strcmp(path, "-")) ? stdin : fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "unable to open '%s'\n", path);
+        exit(1);
+    }
+    int size = 0x10000;
+    int len = 0;
+    char *text = malloc(size);
+    for(;;) {
+        if (!text) {
+            fprintf(stderr, "unable to allocate text\n");
+            exit(1);
+        }
+        len += fread(text+len, 1, size-len-1, fp);
+        if (len < size-1) {
+            break;
+        }
+        size *= 2;
+        text = realloc(text, size);
+    }
+    if (ferror(fp)) {
+        fprintf(stderr, "unable to read '%s'\n", path);
+        exit(1);
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    text[len] = 0;
+    return text;
+}
@@ -0,0 +1,80 @@
+/*
+
+ AmigaNarrator
+
+ Copyright (c) 2023 Arthur Choung. All rights reserved.
+
+ Email: arthur -at- hotdoglinux.com
+
+ This file is part of AmigaNarrator.
+
+ AmigaNarrator is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef TRANSLATOR_LIBRARY_H
+#define TRANSLATOR_LIBRARY_H
+
+#include "memmap.h"
+
+/*
+ the emulated translator.library, only its Translate function is called,
+ with the text and the phonetic text in buffers of the emulated ram
+
+ every instance has its own ram and cpu state, so a translator and a
+ narrator can take turns on the same thread
+
+ this is a part of the front ends, not of libnarrator.a, so unlike the
+ narrator_device library API it prints errors and exits
+ */
+
+#define TRANSLATOR_INPUT_BUFSIZE 0x1000
+#define TRANSLATOR_OUTPUT_BUFSIZE 0x1000
+#define TRANSLATOR_LIBRARY_BUFSIZE 100000
+
+struct translator {
+    unsigned char *ram;
+    struct memmap memmap;
+    void *cpu_context;
+
+    char *library_path;
+    int trace_level;
+
+    unsigned char library_buf[TRANSLATOR_LIBRARY_BUFSIZE];
+    int library_size;
+    unsigned int translatefunc;
+    int done; //Translate has returned
+
+    // translator_begin(), the text that translator_next() goes through
+    char *text;
+    int text_len;
+    int text_pos;
+
+    unsigned long long instruction_count;
+    unsigned long long cycle_count;
+};
+
+struct translator *translator_new();
+void translator_load_library(struct translator *t);
+void translator_init(struct translator *t);
+int translator_translate(struct translator *t, char *str, int len);
+char *translator_output(struct translator *t);
+void translator_begin(struct translator *t, char *text, int len);
+int translator_next(struct translator *t);
+void translator_print_ram_usage(struct translator *t);
+void translator_split_text(char *text, void (*sentence_func)(char *str, int len));
+char *translator_read_text(char *path);
+
+#endif /* TRANSLATOR_LIBRARY_H */